@@ -39,6 +39,8 @@
 #include <vm.h>
 #include <mainbus.h>
 #include <syscall.h>
+#include <proc.h>
+#include "opt-A2.h"
 #include "opt-A3.h"
 
 /* in exception.S */
@@ -182,7 +184,9 @@ mips_trap(struct trapframe *tf)
 			doadjust = false;
 		}
 
+		curcpu->c_userirq = !iskern;
 		mainbus_interrupt(tf);
+		curcpu->c_userirq = false;
 
 		if (doadjust) {
 			KASSERT(curthread->t_curspl == IPL_HIGH);
@@ -192,6 +196,18 @@ mips_trap(struct trapframe *tf)
 		}
 
 		curthread->t_in_interrupt = old_in;
+#if OPT_A2
+		if (!iskern && curproc->p_exiting) {
+			/*
+			 * Another thread is taking the process down. Get
+			 * the interrupt state in sync first, as below for
+			 * a syscall.
+			 */
+			spl = splhigh();
+			splx(spl);
+			proc_checkexit();
+		}
+#endif /* OPT_A2 */
 		goto done2;
 	}
 
@@ -219,6 +235,12 @@ mips_trap(struct trapframe *tf)
 		      tf->tf_v0, tf->tf_a0, tf->tf_a1, tf->tf_a2, tf->tf_a3);
 
 		syscall(tf);
+#if OPT_A2
+		/* another thread may be taking the process down */
+		if (curproc->p_exiting) {
+			proc_checkexit();
+		}
+#endif /* OPT_A2 */
 		goto done;
 	}
 
@@ -87,6 +87,7 @@ syscall(struct trapframe *tf)
 	KASSERT(curthread->t_iplhigh_count == 0);
 
 	callno = tf->tf_v0;
+	curthread->t_usage.u_nsyscalls++;
 
 	/*
 	 * Initialize retval to 0. Many of the system calls don't
@@ -109,10 +110,52 @@ syscall(struct trapframe *tf)
 				 (userptr_t)tf->tf_a1);
 		break;
 
+	    case SYS_nanosleep:
+		err = sys_nanosleep((userptr_t)tf->tf_a0,
+				    (userptr_t)tf->tf_a1);
+		break;
+
 	#if OPT_A2
 			case SYS_fork:
 			 err = sys_fork(tf, (pid_t *)&retval);
 			 break;
+			case SYS_vfork:
+			 err = sys_vfork(tf, (pid_t *)&retval);
+			 break;
+			case SYS_spawn:
+			 err = sys_spawn((char*)tf->tf_a0, (char**)tf->tf_a1,
+					 (pid_t *)&retval);
+			 break;
+			case SYS___thread_create:
+			 err = sys_thread_create(tf, (userptr_t)tf->tf_a0,
+						 (userptr_t)tf->tf_a1,
+						 (userptr_t)tf->tf_a2, (int *)&retval);
+			 break;
+			case SYS_thread_exit:
+			 sys_thread_exit((int)tf->tf_a0);
+			 panic("unexpected return from sys_thread_exit");
+			 break;
+			case SYS_thread_join:
+			 err = sys_thread_join((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+			 break;
+			case SYS_futex_wait:
+			 err = sys_futex_wait((userptr_t)tf->tf_a0, (int)tf->tf_a1);
+			 break;
+			case SYS_futex_wake:
+			 err = sys_futex_wake((userptr_t)tf->tf_a0, (int)tf->tf_a1,
+					      (int *)&retval);
+			 break;
+			case SYS_getrusage:
+			 err = sys_getrusage((int)tf->tf_a0, (userptr_t)tf->tf_a1);
+			 break;
+			case SYS_getpriority:
+			 err = sys_getpriority((int)tf->tf_a0, (int)tf->tf_a1,
+					       &retval);
+			 break;
+			case SYS_setpriority:
+			 err = sys_setpriority((int)tf->tf_a0, (int)tf->tf_a1,
+					       (int)tf->tf_a2);
+			 break;
 	#else
         #endif /* OPT_A2 */
 
@@ -204,6 +247,18 @@ syscall(struct trapframe *tf)
 		mips_usermode(&tf);
 		//panic("unexpected usermode exit failure from enter_forked_process");
 	}
+
+	/*
+	 * Enter user mode in a new thread of an existing process. The
+	 * trapframe is all set up; unlike fork there is no syscall to
+	 * return from, so the pc is left alone.
+	 */
+	void enter_user_thread(struct trapframe *trapf)
+	{
+		struct trapframe tf = *trapf;
+		kfree(trapf);
+		mips_usermode(&tf);
+	}
 #else
 	void
 	enter_forked_process(struct trapframe *tf)
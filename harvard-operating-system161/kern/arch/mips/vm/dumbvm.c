@@ -46,6 +46,17 @@
 /* under dumbvm, always have 48k of user stack */
 #define DUMBVM_STACKPAGES    12
 
+/*
+ * Every other thread gets 16k, in slots below the main stack with an
+ * unmapped guard page under each stack so an overflow faults.
+ */
+#define DUMBVM_TSTACKPAGES   4
+#define TSTACK_TOP(slot) \
+	(USERSTACK - (DUMBVM_STACKPAGES + 1 + \
+		      (slot) * (DUMBVM_TSTACKPAGES + 1)) * PAGE_SIZE)
+#define TSTACK_BOTTOM	(TSTACK_TOP(AS_MAXTSTACKS - 1) - \
+			 DUMBVM_TSTACKPAGES * PAGE_SIZE)
+
 /*
  * Wrap rma_stealmem in a spinlock.
  */
@@ -223,6 +234,36 @@ vm_tlbshootdown(const struct tlbshootdown *ts)
 	panic("dumbvm tried to do tlb shootdown?!\n");
 }
 
+/*
+ * Find the page under a thread stack address, or return EFAULT if it
+ * is in a guard page or a slot nobody has used.
+ */
+static
+int
+tstack_fault(struct addrspace *as, vaddr_t faultaddress, paddr_t *ret)
+{
+	vaddr_t off;
+	int slot;
+	unsigned num;
+
+	off = TSTACK_TOP(0) - faultaddress - 1;
+	slot = off / ((DUMBVM_TSTACKPAGES + 1) * PAGE_SIZE);
+	if (faultaddress < TSTACK_TOP(slot) - DUMBVM_TSTACKPAGES * PAGE_SIZE) {
+		return EFAULT;
+	}
+	num = (faultaddress - (TSTACK_TOP(slot) -
+			       DUMBVM_TSTACKPAGES * PAGE_SIZE)) / PAGE_SIZE;
+
+	spinlock_acquire(&as->as_lock);
+	if (as->as_tstacks[slot] == NULL) {
+		spinlock_release(&as->as_lock);
+		return EFAULT;
+	}
+	*ret = as->as_tstacks[slot][num].ptaddr;
+	spinlock_release(&as->as_lock);
+	return 0;
+}
+
 int
 vm_fault(int faulttype, vaddr_t faultaddress)
 {
@@ -301,6 +342,11 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 		int num = (faultaddress - stackbase)/PAGE_SIZE;
 		paddr = as->pt3[num].ptaddr;
 	}
+	else if (faultaddress >= TSTACK_BOTTOM && faultaddress < TSTACK_TOP(0)) {
+		if (tstack_fault(as, faultaddress, &paddr)) {
+			return EFAULT;
+		}
+	}
 	else {
 		return EFAULT;
 	}
@@ -308,6 +354,8 @@ vm_fault(int faulttype, vaddr_t faultaddress)
 	/* make sure it's page-aligned */
 	KASSERT((paddr & PAGE_FRAME) == paddr);
 
+	curthread->t_usage.u_minflt++;
+
 	/* Disable interrupts on this CPU while frobbing the TLB. */
 	spl = splhigh();
 
@@ -358,6 +406,11 @@ as_create(void)
 	as->as_npages2 = 0;
 	as->pt3 = NULL;
 	as->hasElfLoaded = 0;
+	spinlock_init(&as->as_lock);
+	for (int i = 0; i < AS_MAXTSTACKS; i++) {
+		as->as_tstacks[i] = NULL;
+		as->as_tstackbusy[i] = false;
+	}
 	return as;
 }
 
@@ -379,9 +432,20 @@ as_destroy(struct addrspace *as)
 		free_kpages(PADDR_TO_KVADDR(as->pt3[i].ptaddr));
 	}
 
+	for (int i = 0; i < AS_MAXTSTACKS; i++) {
+		if (as->as_tstacks[i] == NULL) {
+			continue;
+		}
+		for (size_t j = 0; j < DUMBVM_TSTACKPAGES; ++j) {
+			free_kpages(PADDR_TO_KVADDR(as->as_tstacks[i][j].ptaddr));
+		}
+		kfree(as->as_tstacks[i]);
+	}
+
 	kfree(as->pt1);
 	kfree(as->pt2);
 	kfree(as->pt3);
+	spinlock_cleanup(&as->as_lock);
 	kfree(as);
 }
 
@@ -507,6 +571,58 @@ as_define_stack(struct addrspace *as, vaddr_t *stackptr)
 	return 0;
 }
 
+int
+as_define_tstack(struct addrspace *as, vaddr_t *stackptr, int *slot)
+{
+	struct page *pages;
+	int i;
+
+	spinlock_acquire(&as->as_lock);
+	for (i = 0; i < AS_MAXTSTACKS; i++) {
+		if (!as->as_tstackbusy[i]) {
+			break;
+		}
+	}
+	if (i == AS_MAXTSTACKS) {
+		spinlock_release(&as->as_lock);
+		return EAGAIN;
+	}
+	as->as_tstackbusy[i] = true;
+	pages = as->as_tstacks[i];
+	spinlock_release(&as->as_lock);
+
+	if (pages == NULL) {
+		/* first thread in this slot: the pages stay once allocated */
+		pages = kmalloc(DUMBVM_TSTACKPAGES * sizeof(struct page));
+		if (pages == NULL) {
+			as_release_tstack(as, i);
+			return ENOMEM;
+		}
+		for (size_t j = 0; j < DUMBVM_TSTACKPAGES; ++j) {
+			pages[j].ptaddr = getppages(1);
+			as_zero_region(pages[j].ptaddr, 1);
+		}
+		spinlock_acquire(&as->as_lock);
+		as->as_tstacks[i] = pages;
+		spinlock_release(&as->as_lock);
+	}
+
+	*stackptr = TSTACK_TOP(i);
+	*slot = i;
+	return 0;
+}
+
+void
+as_release_tstack(struct addrspace *as, int slot)
+{
+	KASSERT(slot >= 0 && slot < AS_MAXTSTACKS);
+
+	spinlock_acquire(&as->as_lock);
+	KASSERT(as->as_tstackbusy[slot]);
+	as->as_tstackbusy[slot] = false;
+	spinlock_release(&as->as_lock);
+}
+
 int
 as_copy(struct addrspace *old, struct addrspace **ret)
 {
@@ -552,6 +668,30 @@ as_copy(struct addrspace *old, struct addrspace **ret)
 			PAGE_SIZE);
 	}
 
+	/*
+	 * Thread stacks too: the forking thread may be running on one. The
+	 * other threads do not come along, but their slots stay taken
+	 * until the copy is destroyed.
+	 */
+	for (int i = 0; i < AS_MAXTSTACKS; i++) {
+		if (old->as_tstacks[i] == NULL) {
+			continue;
+		}
+		curr = kmalloc(DUMBVM_TSTACKPAGES * sizeof(struct page));
+		if (curr == NULL) {
+			as_destroy(new);
+			return ENOMEM;
+		}
+		for (size_t j = 0; j < DUMBVM_TSTACKPAGES; ++j) {
+			curr[j].ptaddr = getppages(1);
+			memmove((void *)PADDR_TO_KVADDR(curr[j].ptaddr),
+				(const void *)PADDR_TO_KVADDR(old->as_tstacks[i][j].ptaddr),
+				PAGE_SIZE);
+		}
+		new->as_tstacks[i] = curr;
+		new->as_tstackbusy[i] = old->as_tstackbusy[i];
+	}
+
 	*ret = new;
 	return 0;
 }
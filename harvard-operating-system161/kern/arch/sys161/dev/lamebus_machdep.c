@@ -73,6 +73,21 @@ mips_timer_set(uint32_t count)
 		:: "r" (count));
 }
 
+/*
+ * Same for c0_count ($9), to restart the count from zero.
+ */
+static
+void
+mips_count_set(uint32_t count)
+{
+	__asm volatile(
+		".set push;"		/* save assembler mode */
+		".set mips32;"		/* allow MIPS32 registers */
+		"mtc0 %0, $9;"		/* do it */
+		".set pop"		/* restore assembler mode */
+		:: "r" (count));
+}
+
 /*
  * LAMEbus data for the system. (We have only one LAMEbus per system.)
  * This does not need to be locked, because it's constant once
@@ -116,6 +131,24 @@ mainbus_bootstrap(void)
 	mips_timer_set(CPU_FREQUENCY / HZ);
 }
 
+/*
+ * Stop and restart the current cpu's hardclock, for an idle cpu. The
+ * timer can't really be turned off, so push the next interrupt as far
+ * out as it goes (a couple of minutes); a stray tick then is harmless.
+ */
+void
+mainbus_stopclock(void)
+{
+	mips_timer_set(0xffffffff);
+}
+
+void
+mainbus_startclock(void)
+{
+	mips_count_set(0);
+	mips_timer_set(CPU_FREQUENCY / HZ);
+}
+
 /*
  * Start all secondary CPUs.
  */
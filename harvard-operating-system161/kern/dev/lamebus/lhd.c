@@ -289,8 +289,13 @@ config_lhd(struct lhd_softc *lh, int lhdno)
 	/* Get a pointer to the on-chip buffer. */
 	lh->lh_buf = bus_map_area(lh->lh_busdata, lh->lh_buspos, LHD_BUFFER);
 
-	/* Create the semaphores. */
-	lh->lh_clear = sem_create("lhd-clear", 1);
+	/*
+	 * Create the semaphores. lh_clear is fair: lhd_io gives it up
+	 * between sectors and asks for it again right away, and with a
+	 * plain semaphore a big transfer could keep everyone else off
+	 * the disk until it was done.
+	 */
+	lh->lh_clear = sem_create_fair("lhd-clear", 1);
 	if (lh->lh_clear == NULL) {
 		return ENOMEM;
 	}
@@ -36,9 +36,13 @@
 
 
 #include <vm.h>
+#include <spinlock.h>
 
 struct vnode;
 
+/* User stacks for threads other than the first; see as_define_tstack. */
+#define AS_MAXTSTACKS 16
+
 
 /* 
  * Address space - data structure associated with the virtual memory
@@ -56,6 +60,9 @@ struct addrspace {
     size_t as_npages2;
     struct page* pt3;
   int hasElfLoaded;
+    struct spinlock as_lock;	/* protects the thread stacks */
+    struct page* as_tstacks[AS_MAXTSTACKS];	/* NULL until first used */
+    bool as_tstackbusy[AS_MAXTSTACKS];
 };
 
 /*
@@ -92,6 +99,13 @@ struct addrspace {
  *    as_define_stack - set up the stack region in the address space.
  *                (Normally called *after* as_complete_load().) Hands
  *                back the initial stack pointer for the new process.
+ *
+ *    as_define_tstack - set up a user stack for another thread of the
+ *                process. Hands back its initial stack pointer and a
+ *                slot number for as_release_tstack.
+ *
+ *    as_release_tstack - the thread using a stack has exited. The pages
+ *                stay with the address space for the next thread.
  */
 
 struct addrspace *as_create(void);
@@ -108,6 +122,9 @@ int               as_define_region(struct addrspace *as,
 int               as_prepare_load(struct addrspace *as);
 int               as_complete_load(struct addrspace *as);
 int               as_define_stack(struct addrspace *as, vaddr_t *initstackptr);
+int               as_define_tstack(struct addrspace *as, vaddr_t *stackptr,
+                                   int *slot);
+void              as_release_tstack(struct addrspace *as, int slot);
 
 
 /*
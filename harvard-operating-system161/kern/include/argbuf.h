@@ -0,0 +1,38 @@
+#ifndef _ARGBUF_H_
+#define _ARGBUF_H_
+
+/*
+ * Argument vector for a program being started (runprogram, execv,
+ * spawn).
+ *
+ * The strings are packed back to back in one ARG_MAX-sized kernel
+ * buffer. When the program is loaded, the argv[] pointer array is
+ * built in front of them in the same buffer, and the whole block goes
+ * onto the new user stack with a single copyout. ARG_MAX bounds the
+ * strings plus the pointer array, which is exactly what ends up on
+ * the stack, so E2BIG is reported before anything is allocated in the
+ * new address space.
+ *
+ * Functions:
+ *     argbuf_init    - initialize an empty argbuf.
+ *     argbuf_copyin  - fill from a NULL-terminated argv in userspace.
+ *     argbuf_kcopy   - fill from a NULL-terminated argv in the kernel.
+ *     argbuf_copyout - lay argv out below *STACKPTR in the current
+ *                      address space and move *STACKPTR down past it.
+ *                      Can only be done once.
+ *     argbuf_cleanup - release the buffer.
+ */
+
+struct argbuf {
+	char *ab_buf;		/* the strings, NUL-terminated, back to back */
+	size_t ab_len;		/* bytes of ab_buf in use */
+	int ab_argc;		/* number of strings */
+};
+
+void argbuf_init(struct argbuf *ab);
+int argbuf_copyin(struct argbuf *ab, userptr_t uargv);
+int argbuf_kcopy(struct argbuf *ab, char **args);
+int argbuf_copyout(struct argbuf *ab, vaddr_t *stackptr, userptr_t *argv);
+void argbuf_cleanup(struct argbuf *ab);
+
+#endif /* _ARGBUF_H_ */
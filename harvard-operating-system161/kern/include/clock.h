@@ -63,6 +63,13 @@ void timerclock(void);
 
 void gettime(time_t *seconds, uint32_t *nanoseconds);
 
+/*
+ * The same time as one number of nanoseconds, for measuring intervals.
+ * Unlike gettime, this may be called before the clock device attaches,
+ * and returns 0 until then.
+ */
+uint64_t clock_nsecs(void);
+
 void getinterval(time_t secs1, uint32_t nsecs,
                  time_t secs2, uint32_t nsecs2,
                  time_t *rsecs, uint32_t *rnsecs);
@@ -83,5 +90,24 @@ void clocksleep(int seconds);
  */
 void clocknap(int ticks);
 
+/*
+ * Timed sleeps on the timer wheel, which the above are built on; see
+ * clock.c.
+ *
+ * clock_sleepticks() sleeps for at least TICKS timer ticks.
+ * clock_sleep() sleeps for at least the time in TS, and if cut short
+ * leaves what was left of it there.
+ * Both return 0, or EINTR if clock_interrupt() is called on the thread
+ * before or while it sleeps; ENOMEM is possible the first time.
+ *
+ * clock_interrupt() is for taking a thread down (e.g. in a process
+ * that is exiting); it stays interrupted for the rest of its life.
+ */
+struct thread;
+struct timespec;
+int clock_sleepticks(uint32_t ticks);
+int clock_sleep(struct timespec *ts);
+void clock_interrupt(struct thread *t);
+
 
 #endif /* _CLOCK_H_ */
@@ -35,6 +35,30 @@
 #include <threadlist.h>
 #include <machine/vm.h>  /* for TLBSHOOTDOWN_MAX */
 
+/*
+ * Priority levels in each cpu's run queue, 0 being the highest. See
+ * the scheduler in thread.c.
+ */
+#define SCHED_NPRIO	4
+
+/*
+ * Scheduler statistics for one cpu; see schedstat_print. Times are in
+ * nanoseconds, and stay 0 without options schedstat, as does the
+ * latency histogram. Bucket N of that counts wakeups that waited less
+ * than 2^N usec to run; the last bucket counts the rest.
+ */
+#define SCHEDSTAT_LATBUCKETS	20
+
+struct schedstat {
+	uint64_t ss_busyns;		/* running threads */
+	uint64_t ss_idlens;		/* idle */
+	uint64_t ss_waitns;		/* threads runnable but waiting, total */
+	unsigned ss_nswitch;		/* context switches */
+	unsigned ss_nvcsw;		/* ...because the thread slept */
+	unsigned ss_nivcsw;		/* ...because it was preempted */
+	unsigned ss_nwakeups;
+	unsigned ss_lathist[SCHEDSTAT_LATBUCKETS];	/* wakeup to run */
+};
 
 /*
  * Per-cpu structure
@@ -60,13 +84,28 @@ struct cpu {
 	struct thread *c_curthread;	/* Current thread on cpu */
 	struct threadlist c_zombies;	/* List of exited threads */
 	unsigned c_hardclocks;		/* Counter of hardclock() calls */
+	bool c_userirq;			/* current interrupt came from user */
+	struct threadlist c_threadcache;	/* Dead threads kept for reuse */
+	unsigned c_tcache_hits;		/* thread_fork reused one */
+	unsigned c_tcache_misses;	/* thread_fork had to allocate */
+	unsigned c_steals;		/* threads taken from other cpus */
+	struct schedtrace_ring *c_trace; /* see schedtrace.c */
+	struct schedstat c_stats;
+	uint64_t c_switchat;		/* when curthread started running */
+#if OPT_MCSLOCK
+	/* Spinlock queue nodes; neighbours in a queue touch them too. */
+	struct mcsnode c_mcsnodes[SPINLOCK_MCSNODES];
+	unsigned c_mcsused;		/* one bit per node in use */
+#endif
 
 	/*
 	 * Accessed by other cpus.
-	 * Protected by the runqueue lock.
+	 * Protected by the runqueue lock. c_runcount is also read
+	 * without it, as an estimate of this cpu's load.
 	 */
 	bool c_isidle;			/* True if this cpu is idle */
-	struct threadlist c_runqueue;	/* Run queue for this cpu */
+	struct threadlist c_runqueue[SCHED_NPRIO]; /* Run queues, by priority */
+	volatile unsigned c_runcount;	/* Threads on all of c_runqueue[] */
 	struct spinlock c_runqueue_lock;
 
 	/*
@@ -109,6 +148,12 @@ void cpu_machdep_init(struct cpu *);
 /*ASMLINKAGE*/ void cpu_start_secondary(void);
 void cpu_hatch(unsigned software_number);
 
+/*
+ * Look up a cpu by number (c_number), for code that wants to visit all
+ * of them; returns NULL past the last one.
+ */
+struct cpu *cpu_get(unsigned number);
+
 /*
  * Return a string describing the CPU type.
  */
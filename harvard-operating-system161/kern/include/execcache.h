@@ -0,0 +1,74 @@
+#ifndef _EXECCACHE_H_
+#define _EXECCACHE_H_
+
+/*
+ * Executable image cache.
+ *
+ * load_elf keeps the parsed program headers and the file contents of
+ * every loadable segment of recently run programs, keyed by vnode, so
+ * exec'ing the same binary again costs a copy into the new address
+ * space instead of a header parse plus one VOP_READ per segment. The
+ * cache holds a reference to each vnode it knows about. Any write to
+ * or truncate of a vnode drops its entry (see vnode_write). Device
+ * vnodes are not cached.
+ *
+ * Images over EXECCACHE_MAXBYTES are not cached, and load_elf reads
+ * them straight into the new address space instead.
+ *
+ * Functions:
+ *     execcache_lookup     - return the cached image for V with a new
+ *                            reference, or NULL. On NULL, *GEN gets a
+ *                            token to pass to execcache_insert.
+ *     execcache_insert     - offer a freshly read image to the cache.
+ *                            Not taken if its file was written since
+ *                            the lookup that produced GEN, or if it is
+ *                            too big.
+ *     execcache_invalidate - forget V because its contents are changing.
+ *                            Cheap if V is not cached.
+ *     execcache_flush      - forget everything (e.g. before unmount).
+ *     execcache_timing     - account one load_elf for the latency stats.
+ *     execcache_printstats - print hit rate and exec latency.
+ *
+ *     execimage_create     - allocate an empty image for V.
+ *     execimage_release    - drop a reference to an image.
+ */
+
+/* Limits on what we keep around. */
+#define EXECCACHE_MAXENTRIES	8
+#define EXECCACHE_MAXBYTES	(256*1024)
+
+/* The most loadable segments we keep for one executable. */
+#define EXECIMAGE_MAXSEGS	8
+
+struct execseg {
+	vaddr_t es_vaddr;		/* where it goes */
+	size_t es_memsz;		/* size in memory */
+	size_t es_filesz;		/* bytes that come from the file */
+	uint32_t es_flags;		/* PF_R, PF_W, PF_X */
+	off_t es_offset;		/* where they are in the file */
+	char *es_data;			/* those bytes; NULL if not read in */
+};
+
+struct execimage {
+	struct vnode *ei_vnode;		/* the file; we hold a reference */
+	vaddr_t ei_entry;		/* initial PC */
+	unsigned ei_nsegs;
+	struct execseg ei_segs[EXECIMAGE_MAXSEGS];
+	size_t ei_bytes;		/* total of es_filesz */
+	/* these are protected by the cache's lock */
+	unsigned ei_refcount;
+	bool ei_cached;			/* on the cache's list */
+	struct execimage *ei_next;	/* LRU order, most recent first */
+};
+
+struct execimage *execcache_lookup(struct vnode *v, unsigned *gen);
+void execcache_insert(struct execimage *ei, unsigned gen);
+void execcache_invalidate(struct vnode *v);
+void execcache_flush(void);
+void execcache_printstats(void);
+void execcache_timing(bool hit, time_t secs, uint32_t nsecs);
+
+struct execimage *execimage_create(struct vnode *v);
+void execimage_release(struct execimage *ei);
+
+#endif /* _EXECCACHE_H_ */
@@ -0,0 +1,28 @@
+#ifndef _FUTEX_H_
+#define _FUTEX_H_
+
+/*
+ * Futexes: user-level blocking on a word of user memory.
+ *
+ * futex_wait sleeps only if the word still holds the value the caller
+ * saw, checked under the same lock futex_wake takes, so a wakeup that
+ * follows a store to the word cannot be missed. A user-level lock or
+ * condition variable therefore needs the kernel only when it actually
+ * has to block or wake somebody. Futexes are keyed by address space
+ * and user address; there is one table of hashed buckets for the whole
+ * system, each with its own lock and wait channel.
+ *
+ * Functions:
+ *     futex_bootstrap - set up the table; call once during boot.
+ *     futex_wakeas    - wake every thread waiting on a futex in AS, for
+ *                       when the process is being taken down.
+ *
+ * The system calls themselves are in <syscall.h>.
+ */
+
+struct addrspace;
+
+void futex_bootstrap(void);
+void futex_wakeas(struct addrspace *as);
+
+#endif /* _FUTEX_H_ */
@@ -67,6 +67,9 @@ struct rusage {
 	__counter_t ru_nsignals;	/* signals delivered (count) */
 	__counter_t ru_nvcsw;		/* voluntary context switches (count)*/
 	__counter_t ru_nivcsw;		/* involuntary ditto (count) */
+	__counter_t ru_nsyscalls;	/* system calls (count; OS/161 only) */
+	__counter_t ru_nmigrations;	/* moves between cpus (count; ditto) */
+	struct timeval ru_wtime;	/* runnable but waiting (ditto) */
 };
 
 /* limit codes for getrusage/setrusage */
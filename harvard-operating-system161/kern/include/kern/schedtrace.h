@@ -0,0 +1,49 @@
+#ifndef _KERN_SCHEDTRACE_H_
+#define _KERN_SCHEDTRACE_H_
+
+/*
+ * Scheduler trace dump format, shared between the kernel, which writes
+ * it (see kern/thread/schedtrace.c), and the schedtrace tool, which
+ * turns it into a timeline. Fields are in the kernel's byte order.
+ *
+ * A dump is a struct schedtrace_header, then for each cpu a struct
+ * schedtrace_cpu followed by sc_nrecords records, oldest first.
+ */
+
+#define SCHEDTRACE_MAGIC	0x53547231	/* "STr1" */
+#define SCHEDTRACE_NAMELEN	16
+
+struct schedtrace_header {
+	uint32_t sh_magic;
+	uint32_t sh_ncpus;
+};
+
+struct schedtrace_cpu {
+	uint32_t sc_cpu;		/* cpu number */
+	uint32_t sc_nrecords;
+	uint32_t sc_lost;		/* overwritten when the ring wrapped */
+};
+
+/* Event types */
+#define STE_SWITCHOUT	1	/* stopped running; arg is the new state */
+#define STE_SWITCHIN	2	/* started running */
+#define STE_WAKEUP	3	/* made runnable; arg is the cpu it goes to */
+#define STE_SLEEP	4	/* went to sleep on the wchan named */
+#define STE_MIGRATE	5	/* moved; arg is the new cpu */
+
+/* Thread states, for STE_SWITCHOUT */
+#define STS_READY	1	/* preempted or yielded */
+#define STS_SLEEP	2
+#define STS_ZOMBIE	3	/* exited */
+
+struct schedtrace_record {
+	uint32_t sr_sec;		/* when */
+	uint32_t sr_nsec;
+	uint32_t sr_type;		/* STE_* */
+	uint32_t sr_arg;
+	uint32_t sr_thread;		/* which thread (kernel address; reused) */
+	char sr_thname[SCHEDTRACE_NAMELEN];
+	char sr_wcname[SCHEDTRACE_NAMELEN];	/* for STE_SLEEP */
+};
+
+#endif /* _KERN_SCHEDTRACE_H_ */
@@ -0,0 +1,50 @@
+#ifndef _LOCKPROF_H_
+#define _LOCKPROF_H_
+
+/*
+ * Lock contention profiling.
+ *
+ * In a kernel built with "options lockprof", lock_acquire, P and
+ * spinlock_acquire count, for each lock, how often it was acquired
+ * and how often that meant waiting, the total and longest wait, and
+ * (except for semaphores, which are not held as such) the longest
+ * hold. Locks and semaphores are tallied by name, so all the locks
+ * that share a name add up together. Spinlocks have no names; they
+ * are tallied by the address they were acquired from, which
+ * addr2line will turn into a function and line.
+ *
+ *     lockprof_get      - the entry for a lock or semaphore called
+ *                         NAME, or for spinlocks taken at SITE.
+ *     lockprof_now      - a timestamp for the calls below.
+ *     lockprof_acquired - count an acquisition; WAITSTART is when we
+ *                         started waiting, if CONTENDED. Returns the
+ *                         time, for lockprof_released.
+ *     lockprof_released - count the end of a hold that began at ACQAT.
+ *     lockprof_print    - show the N most contended locks.
+ *     lockprof_reset    - zero all the counts.
+ *
+ * None of these take spinlocks, so spinlock_acquire can use them.
+ */
+
+#include "opt-lockprof.h"
+
+#if OPT_LOCKPROF
+
+#define LOCKPROF_LOCK	0
+#define LOCKPROF_SEM	1
+#define LOCKPROF_SPIN	2
+
+struct lockprof;
+
+struct lockprof *lockprof_get(unsigned kind, const char *name,
+			      const void *site);
+uint64_t lockprof_now(void);
+uint64_t lockprof_acquired(struct lockprof *lp, bool contended,
+			   uint64_t waitstart);
+void lockprof_released(struct lockprof *lp, uint64_t acqat);
+void lockprof_print(unsigned n);
+void lockprof_reset(void);
+
+#endif /* OPT_LOCKPROF */
+
+#endif /* _LOCKPROF_H_ */
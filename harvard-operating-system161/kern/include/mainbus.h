@@ -55,6 +55,10 @@ size_t mainbus_ramsize(void);
 /* Switch on an inter-processor interrupt. (Low-level.) */
 void mainbus_send_ipi(struct cpu *target);
 
+/* Stop and restart hardclock on the current cpu, while it is idle. */
+void mainbus_stopclock(void);
+void mainbus_startclock(void);
+
 /*
  * The various ways to shut down the system. (These are very low-level
  * and should generally not be called directly - md_poweroff, for
@@ -45,11 +45,6 @@
 struct addrspace;
 struct vnode;
 
-#if OPT_A2
-        struct lock* lk; //global lock
-        struct array* pid_arr;
-#else
-#endif /* OPT_A2 */
 
 #ifdef UW
 struct semaphore;
@@ -90,12 +85,72 @@ struct addrspace *curproc_setas(struct addrspace *);
 
 
 #if OPT_A2
-        int proc_generatepid(void);
+        /*
+         * PID table. PIDs come from a next-fit bitmap and live processes
+         * are hashed by PID, so allocation and lookup are both O(1) in
+         * the common case. A PID stays allocated until the process has
+         * exited *and* its exit status can no longer be collected.
+         */
+        int proc_generatepid(pid_t *retval);
+        void proc_freepid(pid_t pid);
+        /* The result is only stable if the caller keeps PROC alive. */
+        struct proc *proc_lookup(pid_t pid);
+        /* Stop lookups finding PROC; must come before freeing its pid. */
+        void proc_unhash(struct proc *proc);
+        /*
+         * Nice value of the process with pid PID; setting it applies
+         * to all its threads. ESRCH if there is no such process.
+         */
+        int proc_getnice(pid_t pid, int *nice);
+        int proc_setnice(pid_t pid, int nice);
 
+        /*
+         * Exit-status handoff between a parent and one of its children.
+         * The same object hangs off the child (proc->parent) and the
+         * parent (proc->p_kids); whichever side lets go last frees it
+         * and the child's pid.
+         *
+         * i_lock protects parent. ptr, child_return and i_usage are set by the
+         * exiting child while holding i_lock and, if the parent is still
+         * around, the parent's p_lock; the parent reads them under its
+         * own p_lock; i_launching and i_launcherr work the same way.
+         * While i_launchref is set (under the parent's p_lock) the thread
+         * in vfork/spawn still looks at the record: waitpid leaves it
+         * alone and an exiting child does not queue it as a zombie.
+         * Lock order: i_lock, then p_lock.
+         */
         struct info{
-            pid_t pid;
-            struct proc* ptr;
-            int child_return;
+            pid_t pid;			/* the child's pid */
+            struct proc* ptr;		/* the child; NULL once it exits */
+            struct proc* parent;	/* the parent; NULL once it exits */
+            int child_return;		/* wait status, once ptr is NULL */
+            bool i_launching;		/* parent waits in vfork/spawn */
+            int i_launcherr;		/* why the launch failed; see spawn */
+            bool i_launchref;		/* vfork/spawn not done with it yet */
+            struct usage i_usage;	/* the child's total, with child_return */
+            struct spinlock i_lock;
+            /* parent's side, protected by the parent's p_lock */
+            struct info* i_hashnext;	/* chain in parent's p_kids */
+            struct info* i_zprev;	/* parent's exited-children queue */
+            struct info* i_znext;
+        };
+
+/* Buckets in the per-process child index. Must be a power of two. */
+#define KIDHASH_SIZE 16
+
+        /*
+         * A thread started with thread_create, so that thread_join can
+         * find it and collect its exit status. Under the process's
+         * p_lock. The process's first thread does not have one.
+         */
+        struct uthread {
+            int ut_tid;
+            struct thread *ut_thread;	/* set once the thread is running */
+            int ut_slot;		/* user stack, see as_define_tstack */
+            bool ut_done;		/* has exited with ut_status */
+            bool ut_joined;		/* somebody is in thread_join */
+            int ut_status;
+            struct uthread *ut_next;
         };
 
 /*
@@ -104,16 +159,32 @@ struct addrspace *curproc_setas(struct addrspace *);
         struct proc {
             char *p_name;			/* Name of this process */
             struct spinlock p_lock;		/* Lock for this structure */
-            //struct lock* lk;
-            struct cv* p_cv;
+            struct wchan *p_wchan;		/* waitpid() sleeps here */
             struct threadarray p_threads;	/* Threads in this process */
             /* VM */
             struct addrspace *p_addrspace;	/* virtual address space */
 
             pid_t pid;
-            //pid infos
-            struct info* parent;
-            struct array* children;
+            struct proc *p_hashnext;	/* chain in the pid hash table */
+            //pid infos, see struct info
+            struct info* parent;		/* our exit status goes here */
+            /* children, by pid and in order of exit; under p_lock */
+            struct info* p_kids[KIDHASH_SIZE];
+            unsigned p_nkids;
+            struct info* p_zombies;		/* head: exited first */
+            struct info* p_zombies_tail;
+            bool p_vforked;		/* p_addrspace is our parent's */
+            /* user threads; under p_lock */
+            unsigned p_nthreads;		/* threads running user code */
+            unsigned p_nleaving;		/* ...of which on their way out */
+            struct uthread *p_uthreads;	/* from thread_create */
+            int p_nexttid;
+            bool p_exiting;		/* other threads must leave */
+            int p_nice;			/* setpriority value; under p_lock */
+
+            /* resource usage, under p_lock */
+            struct usage p_usage;		/* threads that have left */
+            struct usage p_cusage;		/* reaped children, in total */
 
             /* VFS */
             struct vnode *p_cwd;		/* current working directory */
@@ -0,0 +1,48 @@
+#ifndef _SCHEDTRACE_H_
+#define _SCHEDTRACE_H_
+
+/*
+ * Scheduler event tracing.
+ *
+ * While the trace is running, thread_switch, thread_make_runnable and
+ * the migration code log each event (see <kern/schedtrace.h>) with a
+ * timestamp to a ring buffer belonging to the cpu they run on. They
+ * log with interrupts off, so a cpu's ring needs no lock. When the
+ * trace is stopped, SCHEDTRACE costs one test of a flag, and in a
+ * kernel built without "options schedtrace" it costs nothing.
+ *
+ *     schedtrace_start - empty the rings and start logging.
+ *     schedtrace_stop  - stop logging.
+ *     schedtrace_dump  - write the rings to a file, for the schedtrace
+ *                        tool. Stop the trace first.
+ */
+
+#include <kern/schedtrace.h>
+#include "opt-schedtrace.h"
+
+#if OPT_SCHEDTRACE
+
+struct thread;
+
+extern volatile bool schedtrace_running;
+
+void schedtrace_log(unsigned type, struct thread *t, const char *wcname,
+		    unsigned arg);
+int schedtrace_start(void);
+void schedtrace_stop(void);
+int schedtrace_dump(char *path);
+
+#define SCHEDTRACE(type, t, wcname, arg) \
+	do { \
+		if (schedtrace_running) { \
+			schedtrace_log(type, t, wcname, arg); \
+		} \
+	} while (0)
+
+#else
+
+#define SCHEDTRACE(type, t, wcname, arg) ((void)0)
+
+#endif /* OPT_SCHEDTRACE */
+
+#endif /* _SCHEDTRACE_H_ */
@@ -36,6 +36,9 @@
  */
 
 #include <cdefs.h>
+#include "opt-ticketlock.h"
+#include "opt-mcslock.h"
+#include <lockprof.h>
 
 /* Inlining support - for making sure an out-of-line copy gets built */
 #ifndef SPINLOCK_INLINE
@@ -53,16 +56,75 @@
  * This structure is made public so spinlocks do not have to be
  * malloc'd; however, code that uses spinlocks should not look inside
  * the structure directly but always use the spinlock API functions.
+ * The exception is the contention counters at the end, which are
+ * there to be read; they are only updated by the holder, and only
+ * kept with options lockprof, so the plain path costs what it did.
+ *
+ * How waiting CPUs spin is picked in the kernel config:
+ *
+ *   (default)		Test-and-test-and-set on lk_lock. Cheapest when
+ *			uncontended, but not fair, and every waiter
+ *			hammers the same word.
+ *   options ticketlock	lk_lock hands out tickets and lk_serving says
+ *			whose turn it is. Waiters go in FIFO order, so
+ *			the wait is bounded by the number of CPUs.
+ *   options mcslock	Waiters queue up in per-CPU nodes, each spinning
+ *			on its own node; lk_lock points to the last one.
+ *			FIFO too, and a release only touches the next
+ *			waiter's node instead of every waiter's cache.
  */
+#if OPT_TICKETLOCK && OPT_MCSLOCK
+#error "options ticketlock and mcslock cannot both be used"
+#endif
+
+#if OPT_MCSLOCK
+/* A CPU's place in a spinlock's queue; see cpu.h for where they live. */
+struct mcsnode {
+	struct mcsnode *volatile mn_next;	/* the CPU queued behind us */
+	volatile bool mn_wait;			/* cleared by the one ahead */
+};
+
+/* Spinlocks one CPU can be holding or waiting for at a time. */
+#define SPINLOCK_MCSNODES	8
+#endif
+
 struct spinlock {
 	volatile spinlock_data_t lk_lock; /* The memory word where we spin. */
+#if OPT_TICKETLOCK
+	volatile spinlock_data_t lk_serving; /* Ticket whose turn it is. */
+#elif OPT_MCSLOCK
+	struct mcsnode *lk_node;	/* Holder's queue node. */
+#endif
 	struct cpu *lk_holder;		/* CPU holding this lock. */
+#if OPT_LOCKPROF
+	unsigned lk_nacquire;		/* times acquired */
+	unsigned lk_ncontended;		/* ...that had to wait */
+	unsigned lk_maxspin;		/* longest wait, in spin loops */
+	struct lockprof *lk_prof;	/* holder's call site */
+	uint64_t lk_acqat;		/* when the holder got it */
+#endif
 };
 
+#if OPT_LOCKPROF
+#define SPINLOCK_PROF_INITIALIZER	, 0, 0, 0, NULL, 0
+#else
+#define SPINLOCK_PROF_INITIALIZER
+#endif
+
 /*
  * Initializer for cases where a spinlock needs to be static or global.
  */
-#define SPINLOCK_INITIALIZER	{ SPINLOCK_DATA_INITIALIZER, NULL }
+#if OPT_TICKETLOCK
+#define SPINLOCK_INITIALIZER \
+	{ SPINLOCK_DATA_INITIALIZER, SPINLOCK_DATA_INITIALIZER, NULL \
+	  SPINLOCK_PROF_INITIALIZER }
+#elif OPT_MCSLOCK
+#define SPINLOCK_INITIALIZER \
+	{ SPINLOCK_DATA_INITIALIZER, NULL, NULL SPINLOCK_PROF_INITIALIZER }
+#else
+#define SPINLOCK_INITIALIZER \
+	{ SPINLOCK_DATA_INITIALIZER, NULL SPINLOCK_PROF_INITIALIZER }
+#endif
 
 /*
  * Spinlock functions.
@@ -74,6 +136,8 @@ struct spinlock {
  * release	Release the lock. May re-enable interrupts.
  *
  * do_i_hold	Check if the current CPU holds the lock.
+ *
+ * resetstats	Zero the contention counters (options lockprof only).
  */
 
 void spinlock_init(struct spinlock *lk);
@@ -84,5 +148,45 @@ void spinlock_release(struct spinlock *lk);
 
 bool spinlock_do_i_hold(struct spinlock *lk);
 
+#if OPT_LOCKPROF
+void spinlock_resetstats(struct spinlock *lk);
+#endif
+
+/*
+ * Reader-writer spinlock. Like a spinlock, it is held by CPUs, and
+ * holding it either way disables interrupts. Writers have preference:
+ * readers do not start while a writer is spinning. But, as with the
+ * sleeping rwlock, the readers spinning when a writer lets go get in
+ * together before the next writer, so neither side starves. Not
+ * recursive.
+ *
+ * init/cleanup		As for spinlocks.
+ * acquire_read		Get the lock shared with other readers.
+ * release_read		Release a read hold.
+ * acquire_write	Get the lock exclusively.
+ * release_write	Release a write hold.
+ * do_i_hold_write	Check if the current CPU holds it for writing.
+ */
+struct rwspinlock {
+	struct spinlock rws_lock;	/* protects the rest */
+	volatile unsigned rws_readers;	/* CPUs holding it for read */
+	struct cpu *volatile rws_writer; /* CPU holding it for write */
+	volatile unsigned rws_wwaiting;	/* CPUs waiting to write */
+	volatile unsigned rws_rwaiting;	/* CPUs waiting to read */
+	volatile unsigned rws_rgen;	/* bumped to let waiting readers in */
+};
+
+#define RWSPINLOCK_INITIALIZER	{ SPINLOCK_INITIALIZER, 0, NULL, 0, 0, 0 }
+
+void rwspinlock_init(struct rwspinlock *rws);
+void rwspinlock_cleanup(struct rwspinlock *rws);
+
+void rwspinlock_acquire_read(struct rwspinlock *rws);
+void rwspinlock_release_read(struct rwspinlock *rws);
+void rwspinlock_acquire_write(struct rwspinlock *rws);
+void rwspinlock_release_write(struct rwspinlock *rws);
+
+bool rwspinlock_do_i_hold_write(struct rwspinlock *rws);
+
 
 #endif /* _SPINLOCK_H_ */
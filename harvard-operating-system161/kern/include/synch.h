@@ -8,21 +8,36 @@
 
 
 #include <spinlock.h>
+#include <cpu.h>	/* for SCHED_NPRIO */
 
 /*
  * Dijkstra-style semaphore.
  *
  * The name field is for easier debugging. A copy of the name is made
  * internally.
+ *
+ * A plain semaphore is not FIFO: a thread arriving in P can take a
+ * count that V just made available before the waiter V woke up gets
+ * to run, and that can happen to the same waiter over and over. A
+ * fair semaphore (sem_create_fair) instead has V hand the count
+ * straight to the oldest waiter, and P never takes a count while
+ * anyone is waiting, so a waiter is passed over by nobody. It costs
+ * throughput: the count sits unused until the waiter runs.
  */
 struct semaphore {
         char *sem_name;
 	struct wchan *sem_wchan;
 	struct spinlock sem_lock;
         volatile int sem_count;
+        bool sem_fair;
+        volatile unsigned sem_nwaiting;	/* fair: threads asleep in P */
+#if OPT_LOCKPROF
+        struct lockprof *sem_prof;
+#endif
 };
 
 struct semaphore *sem_create(const char *name, int initial_count);
+struct semaphore *sem_create_fair(const char *name, int initial_count);
 void sem_destroy(struct semaphore *);
 
 /*
@@ -53,6 +68,14 @@ struct lock {
         struct wchan *lock_wchan;
         struct spinlock lock_spinlock;
         volatile struct thread *lock_holder;
+        /* priority inheritance, see lock_acquire */
+        unsigned lk_nwaiting;			/* waiters counted */
+        unsigned lk_nwaitlevel[SCHED_NPRIO];	/* ...at each level */
+        struct lock *lk_pinext;			/* holder's t_pilocks */
+#if OPT_LOCKPROF
+        struct lockprof *lk_prof;
+        uint64_t lk_acqat;		/* when the holder got it */
+#endif
 
 };
 
@@ -68,6 +91,10 @@ void lock_acquire(struct lock *);
  *    lock_do_i_hold - Return true if the current thread holds the lock;
  *                   false otherwise.
  *
+ * While a thread waits for a lock, the holder runs at the waiter's
+ * priority if that is higher than its own, and so on down a chain of
+ * holders each waiting for another lock.
+ *
  * These operations must be atomic. You get to write them.
  */
 void lock_release(struct lock *);
@@ -117,4 +144,52 @@ void cv_signal(struct cv *cv, struct lock *lock);
 void cv_broadcast(struct cv *cv, struct lock *lock);
 
 
+/*
+ * Reader-writer lock.
+ *
+ * Any number of readers can hold the lock at once, or one writer.
+ * Writers have preference: once a writer is waiting, new readers wait
+ * behind it. But when a writer releases the lock, all the readers
+ * waiting at that moment get it together before the next writer, so
+ * neither side can starve the other.
+ *
+ * Not recursive: a reader that takes the lock for read again can
+ * deadlock behind a waiting writer.
+ *
+ * The name field is for easier debugging. A copy of the name is
+ * made internally.
+ */
+
+struct rwlock {
+        char *rwlock_name;
+        struct spinlock rw_lock;	/* protects the rest */
+        struct wchan *rw_rwchan;	/* readers wait here */
+        struct wchan *rw_wwchan;	/* writers wait here */
+        unsigned rw_readers;		/* holding it for read */
+        struct thread *rw_writer;	/* holding it for write */
+        unsigned rw_rwaiting;		/* readers asleep on rw_rwchan */
+        unsigned rw_wwaiting;		/* writers asleep on rw_wwchan */
+        unsigned rw_rgen;		/* bumped to let waiting readers in */
+};
+
+struct rwlock *rwlock_create(const char *name);
+void rwlock_destroy(struct rwlock *);
+
+/*
+ * Operations:
+ *    rwlock_acquire_read  - Get the lock for reading.
+ *    rwlock_release_read  - Free the lock after reading.
+ *    rwlock_acquire_write - Get the lock for writing, alone.
+ *    rwlock_release_write - Free the lock after writing. Only the
+ *                   thread holding it may do this.
+ *    rwlock_do_i_hold_write - Return true if the current thread holds
+ *                   the lock for writing; false otherwise.
+ */
+void rwlock_acquire_read(struct rwlock *);
+void rwlock_release_read(struct rwlock *);
+void rwlock_acquire_write(struct rwlock *);
+void rwlock_release_write(struct rwlock *);
+bool rwlock_do_i_hold_write(struct rwlock *);
+
+
 #endif /* _SYNCH_H_ */
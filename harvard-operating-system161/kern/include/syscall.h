@@ -33,6 +33,8 @@
         #include "opt-A2.h"
 
 	struct trapframe; /* from <machine/trapframe.h> */
+	struct addrspace; /* from <addrspace.h> */
+	struct argbuf; /* from <argbuf.h> */
 
 	/*
 	 * The system call dispatcher.
@@ -45,10 +47,36 @@
 	 */
 	#if OPT_A2
 		int sys_fork(struct trapframe *parent_tf, pid_t *retval);
+		int sys_vfork(struct trapframe *parent_tf, pid_t *retval);
 		int sys_execv(const char *program, char **args);
+		int sys_spawn(const char *program, char **args, pid_t *retval);
+		int sys_thread_create(struct trapframe *parent_tf,
+				      userptr_t start, userptr_t func,
+				      userptr_t arg, int *retval);
+		void sys_thread_exit(int status);
+		int sys_thread_join(int tid, userptr_t status);
+		int sys_futex_wait(userptr_t uaddr, int val);
+		int sys_futex_wake(userptr_t uaddr, int n, int *retval);
+		int sys_getrusage(int who, userptr_t usage);
+		int sys_getpriority(int which, int who, int *retval);
+		int sys_setpriority(int which, int who, int prio);
+
+		/*
+		 * On the way back to user mode: if another thread is
+		 * taking the process down, leave instead of returning.
+		 */
+		void proc_checkexit(void);
+
+		/* Shared by runprogram, execv and spawn; see runprogram.c. */
+		int loadprogram(char *progname, struct argbuf *args,
+				struct addrspace **oldas, int *argc,
+				userptr_t *argv, vaddr_t *stackptr,
+				vaddr_t *entrypoint);
 
 		/* Helper for fork(). You write this. */
 		void enter_forked_process(struct trapframe *tf, int useless);
+		/* New thread from thread_create; frees TF. */
+		void enter_user_thread(struct trapframe *tf);
         #else
 		void enter_forked_process(struct trapframe *tf);
 
@@ -67,6 +95,7 @@
 
 	int sys_reboot(int code);
 	int sys___time(userptr_t user_seconds, userptr_t user_nanoseconds);
+	int sys_nanosleep(userptr_t req, userptr_t rem);
 
 	#ifdef UW
 	int sys_write(int fdesc,userptr_t ubuf,unsigned int nbytes,int *retval);
@@ -62,6 +62,11 @@ int threadtest3(int, char **);
 int semtest(int, char **);
 int locktest(int, char **);
 int cvtest(int, char **);
+int cvbench(int, char **);
+int rwtest(int, char **);
+int rwbench(int, char **);
+int semfairtest(int, char **);
+int pitest(int, char **);
 
 #ifdef UW
 /* Another thread and synchronization test */
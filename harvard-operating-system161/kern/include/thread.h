@@ -41,6 +41,7 @@
 #include <threadlist.h>
 
 struct cpu;
+struct lock;
 
 /* get machine-dependent defs */
 #include <machine/thread.h>
@@ -64,6 +65,22 @@ typedef enum {
 	S_ZOMBIE,	/* zombie; exited but not yet deleted */
 } threadstate_t;
 
+/*
+ * Resource usage of a thread, or the total for a process's exited
+ * threads or reaped children. Times are in hardclocks; see getrusage.
+ */
+struct usage {
+	uint32_t u_uticks;		/* hardclocks that found it in user mode */
+	uint32_t u_sticks;		/* ...and in the kernel */
+	uint32_t u_minflt;		/* TLB faults handled */
+	uint32_t u_nvcsw;		/* went to sleep */
+	uint32_t u_nivcsw;		/* preempted or yielded */
+	uint32_t u_nsyscalls;
+	uint32_t u_nmigrations;		/* moved to another cpu */
+	uint64_t u_runns;		/* time running, in ns (schedstat) */
+	uint64_t u_waitns;		/* time runnable but waiting (ditto) */
+};
+
 /* Thread structure. */
 struct thread {
 	/*
@@ -105,6 +122,29 @@ struct thread {
 	 * Public fields
 	 */
 
+	struct usage t_usage;		/* goes to t_proc in proc_remthread */
+
+	/* Scheduler state; see thread_tick */
+	int t_nice;			/* from setpriority; see thread_floor */
+	unsigned t_prio;		/* run queue level, 0 is highest */
+	unsigned t_ticks;		/* hardclocks used at this level */
+	unsigned t_lastrun;		/* t_cpu's c_hardclocks when it last ran */
+	uint64_t t_readyat;		/* when it went on a run queue, in ns */
+	bool t_fromsleep;		/* ...because it woke up */
+
+	/* Priority inheritance; see lock_acquire. Under its pi_lock. */
+	unsigned t_inherit;		/* level lent by lock waiters */
+	struct lock *t_blockedon;	/* lock we are waiting for */
+	unsigned t_waitlevel;		/* ...and the level we count at there */
+	struct lock *t_pilocks;		/* locks we hold that have waiters */
+
+	/* Timed sleeps; see clock.c. Under its tw_lock. */
+	struct wchan *t_timerchan;	/* sleeps here; made on first use */
+	uint32_t t_wakeup;		/* deadline, in timerclock ticks */
+	struct thread *t_timernext;	/* timer wheel slot chain */
+	struct thread **t_timerprev;	/* ...NULL if not on the wheel */
+	bool t_timerintr;		/* see clock_interrupt */
+
 	/* add more here as needed */
 };
 
@@ -144,6 +184,27 @@ int thread_fork(const char *name, struct proc *proc,
                 void (*func)(void *, unsigned long),
                 void *data1, unsigned long data2);
 
+/* Add FROM's counts into TO. */
+void usage_add(struct usage *to, const struct usage *from);
+
+/*
+ * Print per-cpu hit/miss counts for the cache of recycled threads
+ * that thread_fork draws from.
+ */
+void thread_cache_printstats(void);
+
+/*
+ * Per-cpu scheduler statistics: context switches and wakeups, plus,
+ * with options schedstat, time busy, idle, and spent by threads
+ * waiting on run queues, and a histogram of how long woken threads
+ * wait to run.
+ *
+ * schedstat_print	Print them.
+ * schedstat_reset	Zero them on every cpu.
+ */
+void schedstat_print(void);
+void schedstat_reset(void);
+
 /*
  * Cause the current thread to exit.
  * Interrupts need not be disabled.
@@ -162,6 +223,29 @@ void thread_yield(void);
  */
 void schedule(void);
 
+/*
+ * Called from hardclock() on every tick: charge the tick to the current
+ * thread's quantum, and switch to another thread if the quantum is used
+ * up or a thread of higher priority is waiting.
+ */
+void thread_tick(void);
+
+/*
+ * A thread's effective priority: its run queue level, or the level it
+ * inherited from threads waiting on its locks if that is higher.
+ * thread_setinherit sets the latter, moving the thread to its new run
+ * queue if it is on one.
+ */
+unsigned thread_level(const struct thread *t);
+void thread_setinherit(struct thread *t, unsigned level);
+
+/* Set a thread's nice value, for setpriority; see thread_floor. */
+void thread_setnice(struct thread *t, int nice);
+
+/* Get and set the base quantum, in hardclocks. */
+unsigned thread_getquantum(void);
+void thread_setquantum(unsigned ticks);
+
 /*
  * Potentially migrate ready threads to other CPUs. Called from the
  * timer interrupt.
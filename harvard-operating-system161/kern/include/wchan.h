@@ -81,5 +81,14 @@ void wchan_sleep(struct wchan *wc);
 void wchan_wakeone(struct wchan *wc);
 void wchan_wakeall(struct wchan *wc);
 
+/*
+ * Move one thread, or all threads, from one wait channel to another
+ * without waking them, so that they are woken from TO instead. FROM
+ * must be locked, and is still locked upon return; TO must not be.
+ * The threads keep their order, after any already on TO.
+ */
+void wchan_moveone(struct wchan *from, struct wchan *to);
+void wchan_moveall(struct wchan *from, struct wchan *to);
+
 
 #endif /* _WCHAN_H_ */
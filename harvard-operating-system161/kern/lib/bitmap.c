@@ -120,6 +120,46 @@ bitmap_alloc(struct bitmap *b, unsigned *index)
         return ENOSPC;
 }
 
+/*
+ * Next-fit version of bitmap_alloc: begin the search at bit START
+ * instead of bit 0, wrapping around at the end. Callers that keep
+ * START just past the last allocation skip over the dense prefix of
+ * the map, which keeps the common case constant-time.
+ */
+int
+bitmap_alloc_from(struct bitmap *b, unsigned start, unsigned *index)
+{
+        unsigned ix;
+        unsigned maxix = DIVROUNDUP(b->nbits, BITS_PER_WORD);
+        unsigned offset;
+        unsigned n;
+
+        if (start >= b->nbits) {
+                start = 0;
+        }
+        ix = start / BITS_PER_WORD;
+        offset = start % BITS_PER_WORD;
+
+        /* maxix+1 passes so the low bits of the first word get a look too */
+        for (n=0; n<=maxix; n++) {
+                if (b->v[ix]!=WORD_ALLBITS) {
+                        for (; offset < BITS_PER_WORD; offset++) {
+                                WORD_TYPE mask = ((WORD_TYPE)1) << offset;
+
+                                if ((b->v[ix] & mask)==0) {
+                                        b->v[ix] |= mask;
+                                        *index = (ix*BITS_PER_WORD)+offset;
+                                        KASSERT(*index < b->nbits);
+                                        return 0;
+                                }
+                        }
+                }
+                offset = 0;
+                ix = (ix + 1) % maxix;
+        }
+        return ENOSPC;
+}
+
 static
 inline
 void
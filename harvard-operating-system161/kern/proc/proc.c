@@ -43,14 +43,17 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <proc.h>
 #include <current.h>
 #include <addrspace.h>
 #include <vnode.h>
 #include <vfs.h>
 #include <synch.h>
+#include <wchan.h>
 #include <kern/fcntl.h>  
 #include <limits.h>
+#include <bitmap.h>
 #include "opt-A2.h"
 
 /*
@@ -58,7 +61,25 @@
  */
 struct proc *kproc;
 #if OPT_A2
-        volatile int global_count = __PID_MIN;
+/*
+ * The PID table.
+ *
+ * pid_map has one bit per possible PID; pid_hint is where the next
+ * search starts, so allocation walks forward through the PID space
+ * instead of rescanning the low, densely used part every time.
+ * pid_table hashes live processes by PID. Consecutive PIDs land in
+ * consecutive buckets, so chains stay short.
+ *
+ * All of it is protected by pid_lock, which is only ever held for a
+ * handful of instructions.
+ */
+#define PIDHASH_SIZE	256	/* must be a power of two */
+#define PIDHASH(pid)	((unsigned)(pid) & (PIDHASH_SIZE - 1))
+
+static struct spinlock pid_lock = SPINLOCK_INITIALIZER;
+static struct bitmap *pid_map;
+static unsigned pid_hint;
+static struct proc *pid_table[PIDHASH_SIZE];
 #else
 #endif /* OPT_A2 */
 
@@ -96,6 +117,11 @@ static struct proc *proc_create(const char *name)
 
 	threadarray_init(&proc->p_threads);
 	spinlock_init(&proc->p_lock);
+#if OPT_A2
+	bzero(&proc->p_usage, sizeof(proc->p_usage));
+	bzero(&proc->p_cusage, sizeof(proc->p_cusage));
+	proc->p_nice = 0;
+#endif
 	/* VM fields */
 	proc->p_addrspace = NULL;
 
@@ -153,6 +179,9 @@ proc_remthread(struct thread *t)
 	for (i=0; i<num; i++) {
 		if (threadarray_get(&proc->p_threads, i) == t) {
 			threadarray_remove(&proc->p_threads, i);
+#if OPT_A2
+			usage_add(&proc->p_usage, &t->t_usage);
+#endif
 			spinlock_release(&proc->p_lock);
 			t->t_proc = NULL;
 			return;
@@ -215,8 +244,17 @@ curproc_setas(struct addrspace *newas)
         void
         proc_bootstrap(void)
         {
-        lk = lock_create("lock");
-          pid_arr = array_create();
+        unsigned i;
+
+          pid_map = bitmap_create(__PID_MAX + 1);
+          if (pid_map == NULL) {
+            panic("could not create the process table\n");
+          }
+          /* PIDs below __PID_MIN are never handed out */
+          for (i = 0; i < __PID_MIN; i++) {
+            bitmap_mark(pid_map, i);
+          }
+          pid_hint = __PID_MIN;
           kproc = proc_create("[kernel]");
           if (kproc == NULL) {
             panic("proc_create for kproc failed\n");
@@ -252,6 +290,13 @@ proc_destroy(struct proc *proc)
 	KASSERT(proc != NULL);
 	KASSERT(proc != kproc);
 
+	/*
+	 * Make sure it is out of the pid table, since proc_setnice
+	 * reaches in from there. Exiting processes are taken out
+	 * earlier, before their pid can be freed; see proc_unhash.
+	 */
+	proc_unhash(proc);
+
 	/*
 	 * We don't take p_lock in here because we must have the only
 	 * reference to this structure. (Otherwise it would be
@@ -293,32 +338,21 @@ proc_destroy(struct proc *proc)
 
 	threadarray_cleanup(&proc->p_threads);
 	spinlock_cleanup(&proc->p_lock);
-	cv_destroy(proc->p_cv);
+	wchan_destroy(proc->p_wchan);
 
-	lock_acquire(lk);//todo
+	/* sys__exit has already handed off the parent/child relationships */
+	KASSERT(proc->parent == NULL);
+	KASSERT(proc->p_nkids == 0);
 	proc->pid = -1;
-	kfree(proc->parent);
-	proc->parent = NULL;
 
-	struct info* info;
+	/* threads nobody joined */
+	while (proc->p_uthreads != NULL) {
+		struct uthread *ut = proc->p_uthreads;
 
-	unsigned int num = array_num(proc->children);
-	if(num>1){
-                for (unsigned int j = num-1; j >0; --j) {
-                        info = array_get(proc->children, j);
-                        kfree(info);
-                        array_remove(proc->children, j);
-                }
+		KASSERT(ut->ut_done);
+		proc->p_uthreads = ut->ut_next;
+		kfree(ut);
 	}
-        num = array_num(proc->children);
-        if(num == 1){
-                info = array_get(proc->children, 0);
-                kfree(info);
-                array_remove(proc->children, 0);
-        }
-	array_destroy(proc->children);
-        lock_release(lk);
-
 
 	kfree(proc->p_name);
 	kfree(proc);
@@ -350,23 +384,45 @@ proc_destroy(struct proc *proc)
 struct proc *
 	proc_create_runprogram(const char *name)
 	{
-		lock_acquire(lk);
 		struct proc *proc;
 		char *console_path;
 
 		proc = proc_create(name);
-		proc->p_cv = cv_create("cv");
-		//todo new fields
-		lock_release(lk);
-		proc->pid = proc_generatepid();
-		lock_acquire(lk);
-		proc->parent = NULL;
-		proc->children = array_create();
-		array_init(proc->children);
 		if (proc == NULL) {
 			return NULL;
 		}
-		lock_release(lk);
+		proc->p_wchan = wchan_create("waitpid");
+		if (proc->p_wchan == NULL || proc_generatepid(&proc->pid)) {
+			if (proc->p_wchan != NULL) {
+				wchan_destroy(proc->p_wchan);
+			}
+			threadarray_cleanup(&proc->p_threads);
+			spinlock_cleanup(&proc->p_lock);
+			kfree(proc->p_name);
+			kfree(proc);
+			return NULL;
+		}
+		proc->parent = NULL;
+		for (unsigned i = 0; i < KIDHASH_SIZE; i++) {
+			proc->p_kids[i] = NULL;
+		}
+		proc->p_nkids = 0;
+		proc->p_zombies = NULL;
+		proc->p_zombies_tail = NULL;
+		proc->p_vforked = false;
+		proc->p_nthreads = 1;
+		proc->p_nleaving = 0;
+		proc->p_uthreads = NULL;
+		proc->p_nexttid = 1;
+		proc->p_exiting = false;
+		/* fork goes through here too, so this is inherited */
+		proc->p_nice = curproc->p_nice;
+
+		/* Make it findable by pid */
+		spinlock_acquire(&pid_lock);
+		proc->p_hashnext = pid_table[PIDHASH(proc->pid)];
+		pid_table[PIDHASH(proc->pid)] = proc;
+		spinlock_release(&pid_lock);
 
 	#ifdef UW
 		/* open the console - this should always succeed */
@@ -417,25 +473,144 @@ struct proc *
 
 
 
-//return new pid
- int proc_generatepid(){
-	lock_acquire(lk);
-	int ret = global_count;
-	if(array_num(pid_arr)>0){
-	        pid_t* tmp = (array_get(pid_arr, 0));
-	        ret = *tmp;
-	        kfree(tmp);
-	        array_remove(pid_arr, 0);
-	}else{
-	        global_count++;
-                if(global_count == __PID_MAX){
-                        global_count = __PID_MIN + 1;
-                        ret = global_count;
-                }
+/*
+ * Allocate a pid. Returns ENPROC if every pid is in use.
+ */
+int
+proc_generatepid(pid_t *retval)
+{
+	unsigned pid;
+	int result;
+
+	spinlock_acquire(&pid_lock);
+	result = bitmap_alloc_from(pid_map, pid_hint, &pid);
+	if (result == 0) {
+		pid_hint = pid + 1;
+	}
+	spinlock_release(&pid_lock);
+	if (result) {
+		return ENPROC;
+	}
+	KASSERT(pid >= __PID_MIN && pid <= __PID_MAX);
+	*retval = pid;
+	return 0;
+}
+
+/*
+ * Take PROC out of the pid table, if it is still there. This must
+ * happen before its pid is freed, or a new process could get the pid
+ * while lookups still find the old one.
+ */
+void
+proc_unhash(struct proc *proc)
+{
+	struct proc **pp;
+
+	spinlock_acquire(&pid_lock);
+	for (pp = &pid_table[PIDHASH(proc->pid)]; *pp != NULL;
+	     pp = &(*pp)->p_hashnext) {
+		if (*pp == proc) {
+			*pp = proc->p_hashnext;
+			proc->p_hashnext = NULL;
+			break;
+		}
 	}
-	lock_release(lk);
-	return ret;
- }
+	spinlock_release(&pid_lock);
+}
+
+/*
+ * Give a pid back once nobody can ask about it any more. The process
+ * that had it must already be out of the pid table.
+ */
+void
+proc_freepid(pid_t pid)
+{
+	KASSERT(pid >= __PID_MIN && pid <= __PID_MAX);
+
+	spinlock_acquire(&pid_lock);
+	bitmap_unmark(pid_map, pid);
+	spinlock_release(&pid_lock);
+}
+
+static
+struct proc *
+proc_lookup_locked(pid_t pid)
+{
+	struct proc *p;
+
+	KASSERT(spinlock_do_i_hold(&pid_lock));
+	for (p = pid_table[PIDHASH(pid)]; p != NULL; p = p->p_hashnext) {
+		if (p->pid == pid) {
+			break;
+		}
+	}
+	return p;
+}
+
+/*
+ * Find a live process by pid. Returns NULL if there is none.
+ */
+struct proc *
+proc_lookup(pid_t pid)
+{
+	struct proc *p;
+
+	spinlock_acquire(&pid_lock);
+	p = proc_lookup_locked(pid);
+	spinlock_release(&pid_lock);
+	return p;
+}
+
+/*
+ * These hold pid_lock throughout, so the process cannot be destroyed
+ * under us. Lock order: pid_lock, then p_lock.
+ */
+
+int
+proc_getnice(pid_t pid, int *nice)
+{
+	struct proc *p;
+	int result = 0;
+
+	spinlock_acquire(&pid_lock);
+	p = proc_lookup_locked(pid);
+	if (p == NULL) {
+		result = ESRCH;
+	}
+	else {
+		spinlock_acquire(&p->p_lock);
+		*nice = p->p_nice;
+		spinlock_release(&p->p_lock);
+	}
+	spinlock_release(&pid_lock);
+	return result;
+}
+
+/*
+ * The new value takes effect for each thread the next time it is put
+ * on a run queue, or at once for the caller; see thread_setnice.
+ */
+int
+proc_setnice(pid_t pid, int nice)
+{
+	struct proc *p;
+	unsigned i;
+
+	spinlock_acquire(&pid_lock);
+	p = proc_lookup_locked(pid);
+	if (p == NULL) {
+		spinlock_release(&pid_lock);
+		return ESRCH;
+	}
+	spinlock_acquire(&p->p_lock);
+	p->p_nice = nice;
+	for (i = 0; i < threadarray_num(&p->p_threads); i++) {
+		thread_setnice(threadarray_get(&p->p_threads, i), nice);
+	}
+	spinlock_release(&p->p_lock);
+	spinlock_release(&pid_lock);
+	return 0;
+}
 //todo  hahahahhah
 #else
 
@@ -42,10 +42,17 @@
 #include <sfs.h>
 #include <syscall.h>
 #include <test.h>
+#include <execcache.h>
 #include "opt-synchprobs.h"
 #include "opt-sfs.h"
 #include "opt-net.h"
 #include "opt-A2.h"
+#include "opt-schedtrace.h"
+#include "opt-lockprof.h"
+#if OPT_SCHEDTRACE
+#include <schedtrace.h>
+#endif
+#include <lockprof.h>
 
 /*
  * In-kernel menu and command dispatcher.
@@ -399,6 +406,125 @@ cmd_kheapstats(int nargs, char **args)
 	return 0;
 }
 
+static
+int
+cmd_execcachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	execcache_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_threadcachestats(int nargs, char **args)
+{
+	(void)nargs;
+	(void)args;
+
+	thread_cache_printstats();
+
+	return 0;
+}
+
+static
+int
+cmd_schedstats(int nargs, char **args)
+{
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		schedstat_reset();
+		return 0;
+	}
+	if (nargs != 1) {
+		kprintf("Usage: ss [reset]\n");
+		return EINVAL;
+	}
+
+	schedstat_print();
+
+	return 0;
+}
+
+static
+int
+cmd_quantum(int nargs, char **args)
+{
+	int ticks;
+
+	if (nargs > 2) {
+		kprintf("Usage: sq [ticks]\n");
+		return EINVAL;
+	}
+	if (nargs == 2) {
+		ticks = atoi(args[1]);
+		if (ticks <= 0) {
+			kprintf("sq: quantum must be positive\n");
+			return EINVAL;
+		}
+		thread_setquantum(ticks);
+	}
+	kprintf("Scheduler quantum: %u hardclocks (%u Hz)\n",
+		thread_getquantum(), HZ);
+
+	return 0;
+}
+
+#if OPT_SCHEDTRACE
+static
+int
+cmd_schedtrace(int nargs, char **args)
+{
+	int result;
+
+	if (nargs == 2 && !strcmp(args[1], "start")) {
+		result = schedtrace_start();
+	}
+	else if (nargs == 2 && !strcmp(args[1], "stop")) {
+		schedtrace_stop();
+		result = 0;
+	}
+	else if (nargs == 3 && !strcmp(args[1], "dump")) {
+		result = schedtrace_dump(args[2]);
+	}
+	else {
+		kprintf("Usage: st start | st stop | st dump file\n");
+		return EINVAL;
+	}
+	if (result) {
+		kprintf("st %s: %s\n", args[1], strerror(result));
+	}
+	return result;
+}
+#endif
+
+#if OPT_LOCKPROF
+static
+int
+cmd_lockprof(int nargs, char **args)
+{
+	int n = 10;
+
+	if (nargs == 2 && !strcmp(args[1], "reset")) {
+		lockprof_reset();
+		return 0;
+	}
+	if (nargs == 2) {
+		n = atoi(args[1]);
+	}
+	if (nargs > 2 || n <= 0) {
+		kprintf("Usage: lp [count | reset]\n");
+		return EINVAL;
+	}
+
+	lockprof_print(n);
+
+	return 0;
+}
+#endif
+
 static
 int
 cmd_dth(int nargs, char **args)
@@ -482,6 +608,11 @@ static const char *testmenu[] = {
 	"[sy1] Semaphore test                ",
 	"[sy2] Lock test             (1)     ",
 	"[sy3] CV test               (1)     ",
+	"[sy4] CV broadcast bench    (1)     ",
+	"[sy5] RW lock test          (1)     ",
+	"[sy6] RW lock throughput    (1)     ",
+	"[sy7] Fair semaphore latency        ",
+	"[sy8] Priority inheritance  (1)     ",
 #ifdef UW
 	"[uw1] UW lock test          (1)     ",
 	"[uw2] UW vmstats test       (3)     ",
@@ -522,6 +653,16 @@ static const char *mainmenu[] = {
 #endif /* UW */
 #endif
 	"[kh] Kernel heap stats              ",
+	"[ec] Exec image cache stats         ",
+	"[tc] Thread cache stats             ",
+	"[ss] Scheduler stats [reset]        ",
+	"[sq] Scheduler quantum [ticks]      ",
+#if OPT_SCHEDTRACE
+	"[st] Scheduler trace start|stop|dump",
+#endif
+#if OPT_LOCKPROF
+	"[lp] Lock contention [count|reset]  ",
+#endif
 	"[q] Quit and shut down              ",
 	NULL
 };
@@ -579,6 +720,16 @@ static struct {
 
 	/* stats */
 	{ "kh",         cmd_kheapstats },
+	{ "ec",         cmd_execcachestats },
+	{ "tc",         cmd_threadcachestats },
+	{ "ss",         cmd_schedstats },
+	{ "sq",         cmd_quantum },
+#if OPT_SCHEDTRACE
+	{ "st",         cmd_schedtrace },
+#endif
+#if OPT_LOCKPROF
+	{ "lp",         cmd_lockprof },
+#endif
 
 	/* base system tests */
 	{ "at",		arraytest },
@@ -596,6 +747,11 @@ static struct {
 	/* synchronization assignment tests */
 	{ "sy2",	locktest },
 	{ "sy3",	cvtest },
+	{ "sy4",	cvbench },
+	{ "sy5",	rwtest },
+	{ "sy6",	rwbench },
+	{ "sy7",	semfairtest },
+	{ "sy8",	pitest },
 #ifdef UW
 	{ "uw1",	uwlocktest1 },
 	{ "uw2",	uwvmstatstest },
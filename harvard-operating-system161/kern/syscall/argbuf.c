@@ -0,0 +1,153 @@
+/*
+ * Argument vectors for runprogram, execv and spawn. See argbuf.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <limits.h>
+#include <copyinout.h>
+#include <argbuf.h>
+
+void
+argbuf_init(struct argbuf *ab)
+{
+	ab->ab_buf = NULL;
+	ab->ab_len = 0;
+	ab->ab_argc = 0;
+}
+
+void
+argbuf_cleanup(struct argbuf *ab)
+{
+	kfree(ab->ab_buf);
+	argbuf_init(ab);
+}
+
+static
+int
+argbuf_alloc(struct argbuf *ab)
+{
+	KASSERT(ab->ab_buf == NULL);
+	ab->ab_buf = kmalloc(ARG_MAX);
+	if (ab->ab_buf == NULL) {
+		return ENOMEM;
+	}
+	ab->ab_len = 0;
+	ab->ab_argc = 0;
+	return 0;
+}
+
+/*
+ * Space left for the next string, keeping room for its pointer and
+ * for the NULL that ends argv.
+ */
+static
+size_t
+argbuf_room(struct argbuf *ab)
+{
+	size_t used;
+
+	used = ab->ab_len + (ab->ab_argc + 2) * sizeof(userptr_t);
+	return used < ARG_MAX ? ARG_MAX - used : 0;
+}
+
+int
+argbuf_copyin(struct argbuf *ab, userptr_t uargv)
+{
+	userptr_t uarg;
+	size_t room, got;
+	int result;
+
+	result = argbuf_alloc(ab);
+	if (result) {
+		return result;
+	}
+
+	while (1) {
+		result = copyin((const_userptr_t)((vaddr_t)uargv +
+				ab->ab_argc * sizeof(userptr_t)),
+				&uarg, sizeof(uarg));
+		if (result) {
+			goto fail;
+		}
+		if (uarg == NULL) {
+			break;
+		}
+		room = argbuf_room(ab);
+		if (room == 0) {
+			result = E2BIG;
+			goto fail;
+		}
+		result = copyinstr((const_userptr_t)uarg,
+				   ab->ab_buf + ab->ab_len, room, &got);
+		if (result == ENAMETOOLONG) {
+			result = E2BIG;
+		}
+		if (result) {
+			goto fail;
+		}
+		/* got includes the NUL */
+		ab->ab_len += got;
+		ab->ab_argc++;
+	}
+	return 0;
+
+ fail:
+	argbuf_cleanup(ab);
+	return result;
+}
+
+int
+argbuf_kcopy(struct argbuf *ab, char **args)
+{
+	size_t len;
+	int result;
+
+	result = argbuf_alloc(ab);
+	if (result) {
+		return result;
+	}
+
+	for (; *args != NULL; args++) {
+		len = strlen(*args) + 1;
+		if (len > argbuf_room(ab)) {
+			argbuf_cleanup(ab);
+			return E2BIG;
+		}
+		memcpy(ab->ab_buf + ab->ab_len, *args, len);
+		ab->ab_len += len;
+		ab->ab_argc++;
+	}
+	return 0;
+}
+
+int
+argbuf_copyout(struct argbuf *ab, vaddr_t *stackptr, userptr_t *argv)
+{
+	size_t ptrsize, total, off;
+	vaddr_t base;
+	userptr_t *ptrs;
+	int i;
+
+	ptrsize = (ab->ab_argc + 1) * sizeof(userptr_t);
+	total = ptrsize + ab->ab_len;
+	KASSERT(total <= ARG_MAX);
+
+	/* argv[] goes at the bottom, 8-aligned; the strings right above */
+	base = (*stackptr - total) & ~(vaddr_t)7;
+
+	memmove(ab->ab_buf + ptrsize, ab->ab_buf, ab->ab_len);
+	ptrs = (userptr_t *)ab->ab_buf;
+	off = 0;
+	for (i = 0; i < ab->ab_argc; i++) {
+		ptrs[i] = (userptr_t)(base + ptrsize + off);
+		off += strlen(ab->ab_buf + ptrsize + off) + 1;
+	}
+	ptrs[ab->ab_argc] = NULL;
+	KASSERT(off == ab->ab_len);
+
+	*stackptr = base;
+	*argv = (userptr_t)base;
+	return copyout(ab->ab_buf, (userptr_t)base, total);
+}
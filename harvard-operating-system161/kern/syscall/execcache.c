@@ -0,0 +1,326 @@
+/*
+ * Executable image cache. See execcache.h.
+ *
+ * Everything here is under one spinlock, held only for list and
+ * counter updates; reading an image in and copying it out happen
+ * outside it, protected by the image's refcount. Entries that get
+ * evicted or invalidated while in use are freed by their last user.
+ *
+ * Every write goes through execcache_invalidate, so it must be cheap
+ * for files that are not cached. Each vnode has a generation, bumped
+ * by every invalidate, and a flag saying whether it is cached, both
+ * under its own vn_eclock; only a vnode with the flag set costs a trip
+ * to ec_lock. A fill is cached only if its vnode's generation has not
+ * moved since the lookup. Lock order: ec_lock, then vn_eclock.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <spinlock.h>
+#include <vnode.h>
+#include <execcache.h>
+
+static struct spinlock ec_lock = SPINLOCK_INITIALIZER;
+static struct execimage *ec_list;	/* most recently used first */
+static unsigned ec_entries;
+static size_t ec_bytes;
+
+static struct {
+	unsigned lookups;
+	unsigned hits;
+	unsigned inserts;
+	unsigned toobig;		/* not cached: over the byte limit */
+	unsigned raced;			/* not cached: file written meanwhile */
+	unsigned evictions;
+	unsigned invalidations;
+	/* load_elf time, split by whether the image was cached */
+	unsigned hitloads, missloads;
+	uint64_t hitnsecs, missnsecs;
+} ec_stats;
+
+struct execimage *
+execimage_create(struct vnode *v)
+{
+	struct execimage *ei;
+
+	ei = kmalloc(sizeof(*ei));
+	if (ei == NULL) {
+		return NULL;
+	}
+	VOP_INCREF(v);
+	ei->ei_vnode = v;
+	ei->ei_entry = 0;
+	ei->ei_nsegs = 0;
+	ei->ei_bytes = 0;
+	ei->ei_refcount = 1;
+	ei->ei_cached = false;
+	ei->ei_next = NULL;
+	return ei;
+}
+
+static
+void
+execimage_destroy(struct execimage *ei)
+{
+	unsigned i;
+
+	KASSERT(ei->ei_refcount == 0);
+	KASSERT(!ei->ei_cached);
+	for (i=0; i<ei->ei_nsegs; i++) {
+		kfree(ei->ei_segs[i].es_data);
+	}
+	VOP_DECREF(ei->ei_vnode);
+	kfree(ei);
+}
+
+void
+execimage_release(struct execimage *ei)
+{
+	bool last;
+
+	spinlock_acquire(&ec_lock);
+	KASSERT(ei->ei_refcount > 0);
+	ei->ei_refcount--;
+	last = (ei->ei_refcount == 0);
+	spinlock_release(&ec_lock);
+
+	if (last) {
+		execimage_destroy(ei);
+	}
+}
+
+/*
+ * Take EI off the list. Returns true if that dropped the last
+ * reference, in which case the caller must destroy it once it has let
+ * go of ec_lock.
+ */
+static
+bool
+execcache_unlink(struct execimage **pp)
+{
+	struct execimage *ei = *pp;
+
+	KASSERT(spinlock_do_i_hold(&ec_lock));
+	KASSERT(ei->ei_cached);
+	*pp = ei->ei_next;
+	ei->ei_next = NULL;
+	ei->ei_cached = false;
+	spinlock_acquire(&ei->ei_vnode->vn_eclock);
+	ei->ei_vnode->vn_ecached = false;
+	spinlock_release(&ei->ei_vnode->vn_eclock);
+	ec_entries--;
+	ec_bytes -= ei->ei_bytes;
+	ei->ei_refcount--;
+	return ei->ei_refcount == 0;
+}
+
+struct execimage *
+execcache_lookup(struct vnode *v, unsigned *gen)
+{
+	struct execimage *ei, **pp;
+
+	spinlock_acquire(&ec_lock);
+	ec_stats.lookups++;
+	for (pp = &ec_list; *pp != NULL; pp = &(*pp)->ei_next) {
+		ei = *pp;
+		if (ei->ei_vnode == v) {
+			/* move to the front */
+			*pp = ei->ei_next;
+			ei->ei_next = ec_list;
+			ec_list = ei;
+			ei->ei_refcount++;
+			ec_stats.hits++;
+			spinlock_release(&ec_lock);
+			return ei;
+		}
+	}
+	spinlock_release(&ec_lock);
+
+	spinlock_acquire(&v->vn_eclock);
+	*gen = v->vn_ecgen;
+	spinlock_release(&v->vn_eclock);
+	return NULL;
+}
+
+void
+execcache_insert(struct execimage *ei, unsigned gen)
+{
+	struct execimage *victims = NULL, *vi, **pp;
+
+	KASSERT(!ei->ei_cached);
+	if (ei->ei_vnode->vn_fs == NULL) {
+		/* a device; see execcache_invalidate */
+		return;
+	}
+	if (ei->ei_bytes > EXECCACHE_MAXBYTES) {
+		spinlock_acquire(&ec_lock);
+		ec_stats.toobig++;
+		spinlock_release(&ec_lock);
+		return;
+	}
+
+	spinlock_acquire(&ec_lock);
+	/* someone else may have beaten us to it */
+	for (vi = ec_list; vi != NULL; vi = vi->ei_next) {
+		if (vi->ei_vnode == ei->ei_vnode) {
+			spinlock_release(&ec_lock);
+			return;
+		}
+	}
+	/*
+	 * Check for a write since the lookup and mark the vnode cached
+	 * in one go, so an invalidate either sees the flag or has moved
+	 * the generation.
+	 */
+	spinlock_acquire(&ei->ei_vnode->vn_eclock);
+	if (gen != ei->ei_vnode->vn_ecgen) {
+		spinlock_release(&ei->ei_vnode->vn_eclock);
+		ec_stats.raced++;
+		spinlock_release(&ec_lock);
+		return;
+	}
+	ei->ei_vnode->vn_ecached = true;
+	spinlock_release(&ei->ei_vnode->vn_eclock);
+
+	/* make room by evicting from the tail */
+	while (ec_entries >= EXECCACHE_MAXENTRIES ||
+	       ec_bytes + ei->ei_bytes > EXECCACHE_MAXBYTES) {
+		KASSERT(ec_list != NULL);
+		for (pp = &ec_list; (*pp)->ei_next != NULL;
+		     pp = &(*pp)->ei_next) {
+			/* nothing */
+		}
+		vi = *pp;
+		ec_stats.evictions++;
+		if (execcache_unlink(pp)) {
+			vi->ei_next = victims;
+			victims = vi;
+		}
+	}
+
+	ei->ei_refcount++;
+	ei->ei_cached = true;
+	ei->ei_next = ec_list;
+	ec_list = ei;
+	ec_entries++;
+	ec_bytes += ei->ei_bytes;
+	ec_stats.inserts++;
+	spinlock_release(&ec_lock);
+
+	/* VOP_DECREF may sleep, so do this without the lock */
+	while (victims != NULL) {
+		vi = victims;
+		victims = vi->ei_next;
+		execimage_destroy(vi);
+	}
+}
+
+void
+execcache_invalidate(struct vnode *v)
+{
+	struct execimage *ei, **pp;
+	bool cached, last = false;
+
+	/* Devices are never cached; console output comes through here. */
+	if (v->vn_fs == NULL) {
+		return;
+	}
+
+	spinlock_acquire(&v->vn_eclock);
+	v->vn_ecgen++;
+	cached = v->vn_ecached;
+	spinlock_release(&v->vn_eclock);
+	if (!cached) {
+		return;
+	}
+
+	spinlock_acquire(&ec_lock);
+	ei = NULL;
+	for (pp = &ec_list; *pp != NULL; pp = &(*pp)->ei_next) {
+		if ((*pp)->ei_vnode == v) {
+			ei = *pp;
+			last = execcache_unlink(pp);
+			ec_stats.invalidations++;
+			break;
+		}
+	}
+	spinlock_release(&ec_lock);
+
+	if (last) {
+		execimage_destroy(ei);
+	}
+}
+
+void
+execcache_flush(void)
+{
+	struct execimage *victims = NULL, *ei;
+
+	/*
+	 * A fill in progress holds its vnode open, so whatever we are
+	 * being flushed for (an unmount) will fail anyway; there is no
+	 * need to keep it from being cached.
+	 */
+	spinlock_acquire(&ec_lock);
+	while (ec_list != NULL) {
+		ei = ec_list;
+		if (execcache_unlink(&ec_list)) {
+			ei->ei_next = victims;
+			victims = ei;
+		}
+	}
+	spinlock_release(&ec_lock);
+
+	while (victims != NULL) {
+		ei = victims;
+		victims = ei->ei_next;
+		execimage_destroy(ei);
+	}
+}
+
+void
+execcache_timing(bool hit, time_t secs, uint32_t nsecs)
+{
+	uint64_t ns = (uint64_t)secs * 1000000000 + nsecs;
+
+	spinlock_acquire(&ec_lock);
+	if (hit) {
+		ec_stats.hitloads++;
+		ec_stats.hitnsecs += ns;
+	}
+	else {
+		ec_stats.missloads++;
+		ec_stats.missnsecs += ns;
+	}
+	spinlock_release(&ec_lock);
+}
+
+void
+execcache_printstats(void)
+{
+	unsigned lookups, hits, entries;
+	size_t bytes;
+	unsigned long hitus, missus;
+
+	spinlock_acquire(&ec_lock);
+	lookups = ec_stats.lookups;
+	hits = ec_stats.hits;
+	entries = ec_entries;
+	bytes = ec_bytes;
+	hitus = ec_stats.hitloads == 0 ? 0 :
+		(unsigned long)(ec_stats.hitnsecs / ec_stats.hitloads / 1000);
+	missus = ec_stats.missloads == 0 ? 0 :
+		(unsigned long)(ec_stats.missnsecs / ec_stats.missloads / 1000);
+	spinlock_release(&ec_lock);
+
+	kprintf("Exec cache: %u entries, %lu bytes (limits %u, %u)\n",
+		entries, (unsigned long)bytes,
+		EXECCACHE_MAXENTRIES, EXECCACHE_MAXBYTES);
+	kprintf("  lookups %u, hits %u (%u%%)\n", lookups, hits,
+		lookups == 0 ? 0 : hits * 100 / lookups);
+	kprintf("  inserts %u, too big %u, raced %u, evictions %u, "
+		"invalidations %u\n", ec_stats.inserts, ec_stats.toobig,
+		ec_stats.raced, ec_stats.evictions, ec_stats.invalidations);
+	kprintf("  average load_elf: %lu us cached, %lu us uncached\n",
+		hitus, missus);
+}
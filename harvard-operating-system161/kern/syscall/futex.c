@@ -0,0 +1,185 @@
+/*
+ * Futex wait and wake. See futex.h.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <lib.h>
+#include <copyinout.h>
+#include <synch.h>
+#include <wchan.h>
+#include <current.h>
+#include <proc.h>
+#include <addrspace.h>
+#include <syscall.h>
+#include <futex.h>
+
+/* Buckets in the futex table. Must be a power of two. */
+#define FUTEX_HASHSIZE 64
+
+/* A thread in futex_wait, queued on its bucket in arrival order. */
+struct futex_waiter {
+	struct addrspace *fw_as;
+	vaddr_t fw_addr;
+	bool fw_woken;			/* set, and dequeued, by the waker */
+	struct futex_waiter *fw_next;
+};
+
+/*
+ * The waiters for every futex that hashes here, and the channel they
+ * all sleep on. fb_lock is a sleep lock, not a spinlock, because the
+ * user's word is read while holding it and that may fault.
+ */
+struct futex_bucket {
+	struct lock *fb_lock;
+	struct wchan *fb_wchan;
+	struct futex_waiter *fb_waiters;
+};
+
+static struct futex_bucket futex_table[FUTEX_HASHSIZE];
+
+static
+struct futex_bucket *
+futex_hash(struct addrspace *as, vaddr_t addr)
+{
+	unsigned h;
+
+	h = (addr >> 2) ^ ((uintptr_t)as >> 6);
+	return &futex_table[h & (FUTEX_HASHSIZE - 1)];
+}
+
+void
+futex_bootstrap(void)
+{
+	unsigned i;
+
+	for (i = 0; i < FUTEX_HASHSIZE; i++) {
+		futex_table[i].fb_lock = lock_create("futex");
+		futex_table[i].fb_wchan = wchan_create("futex");
+		if (futex_table[i].fb_lock == NULL ||
+		    futex_table[i].fb_wchan == NULL) {
+			panic("futex_bootstrap: out of memory\n");
+		}
+		futex_table[i].fb_waiters = NULL;
+	}
+}
+
+/*
+ * Dequeue and mark up to MAX (all, if negative) waiters in FB that
+ * match AS and, unless ANYADDR, ADDR, and wake them. Returns how many.
+ * Caller holds fb_lock.
+ */
+static
+int
+futex_dequeue(struct futex_bucket *fb, struct addrspace *as, vaddr_t addr,
+	      bool anyaddr, int max)
+{
+	struct futex_waiter **pp, *fw;
+	int n = 0;
+
+	KASSERT(lock_do_i_hold(fb->fb_lock));
+
+	pp = &fb->fb_waiters;
+	while ((fw = *pp) != NULL && (max < 0 || n < max)) {
+		if (fw->fw_as == as && (anyaddr || fw->fw_addr == addr)) {
+			*pp = fw->fw_next;
+			fw->fw_woken = true;
+			n++;
+		}
+		else {
+			pp = &fw->fw_next;
+		}
+	}
+	if (n > 0) {
+		/* the others sharing the bucket go back to sleep */
+		wchan_wakeall(fb->fb_wchan);
+	}
+	return n;
+}
+
+/*
+ * futex_wait: if the int at UADDR still holds VAL, sleep until a
+ * futex_wake on UADDR. Returns EAGAIN at once if it does not. As with
+ * any futex, the caller must recheck its condition afterwards.
+ */
+int
+sys_futex_wait(userptr_t uaddr, int val)
+{
+	struct addrspace *as = curproc_getas();
+	struct futex_bucket *fb;
+	struct futex_waiter fw, **pp;
+	int cur;
+	int result;
+
+	if ((vaddr_t)uaddr % sizeof(int) != 0) {
+		return EINVAL;
+	}
+	fb = futex_hash(as, (vaddr_t)uaddr);
+
+	lock_acquire(fb->fb_lock);
+	result = copyin((const_userptr_t)uaddr, &cur, sizeof(int));
+	if (result) {
+		lock_release(fb->fb_lock);
+		return result;
+	}
+	if (cur != val) {
+		lock_release(fb->fb_lock);
+		return EAGAIN;
+	}
+	if (curproc->p_exiting) {
+		/* futex_wakeas may have been through here already */
+		lock_release(fb->fb_lock);
+		return EINTR;
+	}
+
+	fw.fw_as = as;
+	fw.fw_addr = (vaddr_t)uaddr;
+	fw.fw_woken = false;
+	fw.fw_next = NULL;
+	for (pp = &fb->fb_waiters; *pp != NULL; pp = &(*pp)->fw_next) {
+		/* nothing */
+	}
+	*pp = &fw;
+
+	while (!fw.fw_woken) {
+		wchan_lock(fb->fb_wchan);
+		lock_release(fb->fb_lock);
+		wchan_sleep(fb->fb_wchan);
+		lock_acquire(fb->fb_lock);
+	}
+	lock_release(fb->fb_lock);
+	return 0;
+}
+
+/*
+ * futex_wake: wake up to N threads waiting on UADDR, oldest first, and
+ * return how many there were.
+ */
+int
+sys_futex_wake(userptr_t uaddr, int n, int *retval)
+{
+	struct addrspace *as = curproc_getas();
+	struct futex_bucket *fb;
+
+	if ((vaddr_t)uaddr % sizeof(int) != 0 || n < 0) {
+		return EINVAL;
+	}
+	fb = futex_hash(as, (vaddr_t)uaddr);
+
+	lock_acquire(fb->fb_lock);
+	*retval = futex_dequeue(fb, as, (vaddr_t)uaddr, false, n);
+	lock_release(fb->fb_lock);
+	return 0;
+}
+
+void
+futex_wakeas(struct addrspace *as)
+{
+	unsigned i;
+
+	for (i = 0; i < FUTEX_HASHSIZE; i++) {
+		lock_acquire(futex_table[i].fb_lock);
+		futex_dequeue(&futex_table[i], as, 0, true, -1);
+		lock_release(futex_table[i].fb_lock);
+	}
+}
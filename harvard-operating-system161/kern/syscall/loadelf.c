@@ -58,6 +58,8 @@
 #include <current.h>
 #include <addrspace.h>
 #include <vnode.h>
+#include <clock.h>
+#include <execcache.h>
 #include <elf.h>
 #include <types.h>
 #include <spl.h>
@@ -66,8 +68,9 @@
 /*
  * Load a segment at virtual address VADDR. The segment in memory
  * extends from VADDR up to (but not including) VADDR+MEMSIZE. The
- * segment on disk is located at file offset OFFSET and has length
- * FILESIZE.
+ * part of the segment that comes from the file is FILESIZE bytes
+ * long. It has already been read into DATA (see elf_readimage), or,
+ * if DATA is NULL, is read here from file offset OFFSET.
  *
  * FILESIZE may be less than MEMSIZE; if so the remaining portion of
  * the in-memory segment should be zero-filled.
@@ -79,20 +82,14 @@
  */
 static
 int
-load_segment(struct addrspace *as, struct vnode *v,
-	     off_t offset, vaddr_t vaddr, 
-	     size_t memsize, size_t filesize,
-	     int is_executable)
+load_segment(struct addrspace *as, struct vnode *v, off_t offset,
+	     const char *data, vaddr_t vaddr, size_t memsize,
+	     size_t filesize, int is_executable)
 {
 	struct iovec iov;
 	struct uio u;
 	int result;
 
-	if (filesize > memsize) {
-		kprintf("ELF: warning: segment filesize > segment memsize\n");
-		filesize = memsize;
-	}
-
 	DEBUG(DB_EXEC, "ELF: Loading %lu bytes to 0x%lx\n", 
 	      (unsigned long) filesize, (unsigned long) vaddr);
 
@@ -100,21 +97,28 @@ load_segment(struct addrspace *as, struct vnode *v,
 	iov.iov_len = memsize;		 // length of the memory space
 	u.uio_iov = &iov;
 	u.uio_iovcnt = 1;
-	u.uio_resid = filesize;          // amount to read from the file
+	u.uio_resid = filesize;          // amount to copy in
 	u.uio_offset = offset;
 	u.uio_segflg = is_executable ? UIO_USERISPACE : UIO_USERSPACE;
 	u.uio_rw = UIO_READ;
 	u.uio_space = as;
 
-	result = VOP_READ(v, &u);
-	if (result) {
-		return result;
+	if (data != NULL) {
+		result = uiomove((void *)data, filesize, &u);
+		if (result) {
+			return result;
+		}
 	}
-
-	if (u.uio_resid != 0) {
-		/* short read; problem with executable? */
-		kprintf("ELF: short read on segment - file truncated?\n");
-		return ENOEXEC;
+	else {
+		result = VOP_READ(v, &u);
+		if (result) {
+			return result;
+		}
+		if (u.uio_resid != 0) {
+			/* short read; problem with executable? */
+			kprintf("ELF: short read on segment - file truncated?\n");
+			return ENOEXEC;
+		}
 	}
 
 	/*
@@ -149,21 +153,22 @@ load_segment(struct addrspace *as, struct vnode *v,
 }
 
 /*
- * Load an ELF executable user program into the current address space.
- *
- * Returns the entry point (initial PC) for the program in ENTRYPOINT.
+ * Read the executable V: check the header, collect the loadable
+ * segments and, if the image is small enough for the cache to keep,
+ * read their file contents into EI. Bigger images are left for
+ * load_segment to read straight into the address space, as they would
+ * only be thrown away again.
  */
+static
 int
-load_elf(struct vnode *v, vaddr_t *entrypoint)
+elf_readimage(struct vnode *v, struct execimage *ei)
 {
 	Elf_Ehdr eh;   /* Executable header */
 	Elf_Phdr ph;   /* "Program header" = segment header */
 	int result, i;
 	struct iovec iov;
 	struct uio ku;
-	struct addrspace *as;
-
-	as = curproc_getas();
+	struct execseg *es;
 
 	/*
 	 * Read the executable header from offset 0 in the file.
@@ -206,12 +211,12 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	}
 
 	/*
-	 * Go through the list of segments and set up the address space.
+	 * Go through the list of segments and remember the loadable
+	 * ones.
 	 *
 	 * Ordinarily there will be one code segment, one read-only
 	 * data segment, and one data/bss segment, but there might
-	 * conceivably be more. You don't need to support such files
-	 * if it's unduly awkward to do so.
+	 * conceivably be more. We keep up to EXECIMAGE_MAXSEGS.
 	 *
 	 * Note that the expression eh.e_phoff + i*eh.e_phentsize is 
 	 * mandated by the ELF standard - we use sizeof(ph) to load,
@@ -246,65 +251,136 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 			return ENOEXEC;
 		}
 
-		result = as_define_region(as,
-					  ph.p_vaddr, ph.p_memsz,
-					  ph.p_flags & PF_R,
-					  ph.p_flags & PF_W,
-					  ph.p_flags & PF_X);
-		if (result) {
-			return result;
+		if (ei->ei_nsegs == EXECIMAGE_MAXSEGS) {
+			kprintf("loadelf: too many segments\n");
+			return ENOEXEC;
+		}
+		if (ph.p_filesz > ph.p_memsz) {
+			kprintf("ELF: warning: segment filesize > "
+				"segment memsize\n");
+			ph.p_filesz = ph.p_memsz;
 		}
-	}
 
-	result = as_prepare_load(as);
-	if (result) {
-		return result;
+		es = &ei->ei_segs[ei->ei_nsegs];
+		es->es_vaddr = ph.p_vaddr;
+		es->es_memsz = ph.p_memsz;
+		es->es_filesz = ph.p_filesz;
+		es->es_flags = ph.p_flags;
+		es->es_offset = ph.p_offset;
+		es->es_data = NULL;
+		ei->ei_nsegs++;
+		ei->ei_bytes += ph.p_filesz;
 	}
 
-	/*
-	 * Now actually load each segment.
-	 */
+	ei->ei_entry = eh.e_entry;
+	if (ei->ei_bytes > EXECCACHE_MAXBYTES) {
+		return 0;
+	}
 
-	for (i=0; i<eh.e_phnum; i++) {
-		off_t offset = eh.e_phoff + i*eh.e_phentsize;
-		uio_kinit(&iov, &ku, &ph, sizeof(ph), offset, UIO_READ);
+	/* Now read in their contents. */
+	for (i=0; i<(int)ei->ei_nsegs; i++) {
+		es = &ei->ei_segs[i];
+		es->es_data = kmalloc(es->es_filesz > 0 ? es->es_filesz : 1);
+		if (es->es_data == NULL) {
+			return ENOMEM;
+		}
 
+		uio_kinit(&iov, &ku, es->es_data, es->es_filesz,
+			  es->es_offset, UIO_READ);
 		result = VOP_READ(v, &ku);
 		if (result) {
 			return result;
 		}
-
 		if (ku.uio_resid != 0) {
 			/* short read; problem with executable? */
-			kprintf("ELF: short read on phdr - file truncated?\n");
+			kprintf("ELF: short read on segment - file truncated?\n");
 			return ENOEXEC;
 		}
+	}
 
-		switch (ph.p_type) {
-		    case PT_NULL: /* skip */ continue;
-		    case PT_PHDR: /* skip */ continue;
-		    case PT_MIPS_REGINFO: /* skip */ continue;
-		    case PT_LOAD: break;
-		    default:
-			kprintf("loadelf: unknown segment type %d\n", 
-				ph.p_type);
-			return ENOEXEC;
-		}
+	return 0;
+}
+
+/*
+ * Load an ELF executable user program into the current address space.
+ *
+ * Returns the entry point (initial PC) for the program in ENTRYPOINT.
+ *
+ * The parsed headers and segment contents come from the exec image
+ * cache when the same file has been run recently; otherwise they are
+ * read here and offered to the cache.
+ */
+int
+load_elf(struct vnode *v, vaddr_t *entrypoint)
+{
+	struct execimage *ei;
+	struct execseg *es;
+	struct addrspace *as;
+	time_t secs, endsecs;
+	uint32_t nsecs, endnsecs;
+	unsigned gen, i;
+	bool hit;
+	int result;
 
-		result = load_segment(as, v, ph.p_offset, ph.p_vaddr, 
-				      ph.p_memsz, ph.p_filesz,
-				      ph.p_flags & PF_X);
+	as = curproc_getas();
+	gettime(&secs, &nsecs);
+
+	ei = execcache_lookup(v, &gen);
+	hit = (ei != NULL);
+	if (!hit) {
+		ei = execimage_create(v);
+		if (ei == NULL) {
+			return ENOMEM;
+		}
+		result = elf_readimage(v, ei);
 		if (result) {
+			execimage_release(ei);
 			return result;
 		}
+		execcache_insert(ei, gen);
+	}
+
+	/*
+	 * Set up the address space.
+	 */
+
+	for (i=0; i<ei->ei_nsegs; i++) {
+		es = &ei->ei_segs[i];
+		result = as_define_region(as,
+					  es->es_vaddr, es->es_memsz,
+					  es->es_flags & PF_R,
+					  es->es_flags & PF_W,
+					  es->es_flags & PF_X);
+		if (result) {
+			goto done;
+		}
+	}
+
+	result = as_prepare_load(as);
+	if (result) {
+		goto done;
+	}
+
+	/*
+	 * Now actually load each segment.
+	 */
+
+	for (i=0; i<ei->ei_nsegs; i++) {
+		es = &ei->ei_segs[i];
+		result = load_segment(as, v, es->es_offset, es->es_data,
+				      es->es_vaddr, es->es_memsz,
+				      es->es_filesz, es->es_flags & PF_X);
+		if (result) {
+			goto done;
+		}
 	}
 
 	result = as_complete_load(as);
 	if (result) {
-		return result;
+		goto done;
 	}
 
-	*entrypoint = eh.e_entry;
+	*entrypoint = ei->ei_entry;
 	as->hasElfLoaded = 1;
 
 
@@ -317,6 +393,14 @@ load_elf(struct vnode *v, vaddr_t *entrypoint)
 	}
 	splx(spl);
 
+	gettime(&endsecs, &endnsecs);
+	if (endnsecs < nsecs) {
+		endnsecs += 1000000000;
+		endsecs--;
+	}
+	execcache_timing(hit, endsecs - secs, endnsecs - nsecs);
 
-	return 0;
+ done:
+	execimage_release(ei);
+	return result;
 }
@@ -2,6 +2,8 @@
 #include <kern/errno.h>
 #include <kern/unistd.h>
 #include <kern/wait.h>
+#include <kern/time.h>
+#include <kern/resource.h>
 #include <lib.h>
 #include <syscall.h>
 #include <current.h>
@@ -13,6 +15,11 @@
 #include <synch.h>
 #include <kern/fcntl.h>
 #include <vfs.h>
+#include <wchan.h>
+#include <limits.h>
+#include <argbuf.h>
+#include <futex.h>
+#include <clock.h>
 #include "opt-A2.h"
 
   /* this implementation of sys__exit does not do anything with the exit code */
@@ -20,148 +27,381 @@
 
 //todo
 #if OPT_A2
-void sys__exit(int exitcode) {
-    lock_acquire(lk);
-    struct addrspace *as;
-    struct proc *p = curproc;
+  /*
+   * The per-process child index: children hashed by pid, plus a FIFO
+   * of the ones that have exited and not been reaped yet, so waitpid
+   * never has to look at more than a short hash chain. All of these
+   * are called with the parent's p_lock held.
+   */
+  #define KIDHASH(pid) ((unsigned)(pid) & (KIDHASH_SIZE - 1))
+
+  static
+  struct info *
+  kid_lookup(struct proc *p, pid_t pid)
+  {
+    struct info *in;
+
+    KASSERT(spinlock_do_i_hold(&p->p_lock));
+    for (in = p->p_kids[KIDHASH(pid)]; in != NULL; in = in->i_hashnext) {
+      if (in->pid == pid) {
+        return in;
+      }
+    }
+    return NULL;
+  }
+
+  static
+  void
+  kid_add(struct proc *p, struct info *in)
+  {
+    KASSERT(spinlock_do_i_hold(&p->p_lock));
+    in->i_hashnext = p->p_kids[KIDHASH(in->pid)];
+    in->i_zprev = in->i_znext = NULL;
+    p->p_kids[KIDHASH(in->pid)] = in;
+    p->p_nkids++;
+  }
+
+  /* child IN has exited: queue it for waitpid(-1) */
+  static
+  void
+  kid_zombify(struct proc *p, struct info *in)
+  {
+    KASSERT(spinlock_do_i_hold(&p->p_lock));
+    in->i_znext = NULL;
+    in->i_zprev = p->p_zombies_tail;
+    if (p->p_zombies_tail != NULL) {
+      p->p_zombies_tail->i_znext = in;
+    }else{
+      p->p_zombies = in;
+    }
+    p->p_zombies_tail = in;
+  }
 
-    if((curproc->parent) != NULL) {//If one has a parent
-      if((curproc->parent->ptr) == NULL){ //If one has a parent and dead
-        //child exit and parent is dead
-        //it recycle itself
-        int unwanted_pid = curproc->pid;
-        pid_t* tmp = kmalloc(sizeof(int));
-       *tmp = unwanted_pid;
-        array_add(pid_arr, tmp, NULL);
-      }else if ((curproc->parent->ptr) != NULL){ //If one has a parent and alive
-        //inform parent and place return value if parent is still alive
-        //we use the lock of the object that we are changing it field
-        //we want to modify the parent's fields
-        struct array *p_children = curproc->parent->ptr->children;
-
-        unsigned int p_c_length = array_num(p_children);
-        //loop through the entire children
-        // 1. find the pid
-        // 2. change return value then exit
-        for (unsigned int i = 0; i < p_c_length; ++i) {
-          struct info *inf = array_get(p_children, i);
-          if ((inf->pid == curproc->pid)&&(inf->ptr != NULL)) {
-            inf->child_return = _MKWAIT_EXIT(exitcode);
-            inf->ptr = NULL;
-            break;
-          }
+  /* forget about exited child IN, which may or may not be queued */
+  static
+  void
+  kid_remove(struct proc *p, struct info *in)
+  {
+    struct info **pp;
+
+    KASSERT(spinlock_do_i_hold(&p->p_lock));
+    KASSERT(in->ptr == NULL);
+    for (pp = &p->p_kids[KIDHASH(in->pid)]; *pp != in; pp = &(*pp)->i_hashnext) {
+      KASSERT(*pp != NULL);
+    }
+    *pp = in->i_hashnext;
+    p->p_nkids--;
+
+    if (in->i_zprev != NULL) {
+      in->i_zprev->i_znext = in->i_znext;
+    }else if (p->p_zombies == in) {
+      p->p_zombies = in->i_znext;
+    }
+    if (in->i_znext != NULL) {
+      in->i_znext->i_zprev = in->i_zprev;
+    }else if (p->p_zombies_tail == in) {
+      p->p_zombies_tail = in->i_zprev;
+    }
+  }
+
+  /*
+   * Hand our exit status to whoever can still collect it and let go of
+   * our side of every parent/child relationship.
+   *
+   * Each relationship is a struct info shared by the parent and the
+   * child (see proc.h). Only the two processes involved ever touch it,
+   * so exiting, waiting and forking in unrelated process families
+   * never contend on anything.
+   */
+  static
+  void
+  proc_exit_handoff(struct proc *p, int waitcode)
+  {
+    struct info *me = p->parent;
+    struct proc *parent;
+
+    //once our status is posted the parent can reap us and free our
+    //pid, so stop lookups from finding us first
+    proc_unhash(p);
+
+    if (me == NULL) {
+      //nobody can wait for us (started from the menu)
+      proc_freepid(p->pid);
+    }else{
+      spinlock_acquire(&me->i_lock);
+      parent = me->parent;
+      if (parent != NULL) {
+        //parent is alive: post the status under its lock and wake it
+        spinlock_acquire(&parent->p_lock);
+        me->child_return = waitcode;
+        me->i_usage = p->p_usage;
+        usage_add(&me->i_usage, &p->p_cusage);
+        me->ptr = NULL;
+        if (!me->i_launchref) {
+          //(otherwise vfork/spawn queues us, or reaps us if we failed)
+          kid_zombify(parent, me);
         }
-        //wake the parents that are still alive and
-        //waiting on parent its own lock
-        cv_broadcast(curproc->parent->ptr->p_cv, lk);
+        wchan_wakeall(parent->p_wchan);
+        spinlock_release(&parent->p_lock);
+        spinlock_release(&me->i_lock);
+      }else{
+        //parent is dead, so we are the last user: recycle ourselves
+        spinlock_release(&me->i_lock);
+        proc_freepid(p->pid);
+        spinlock_cleanup(&me->i_lock);
+        kfree(me);
       }
     }
+    p->parent = NULL;
+
+    //orphan the children that are still running, recycle the dead ones.
+    //Once in->parent is NULL no child touches our index any more, and
+    //nobody else adds to it, so we can take it apart without p_lock.
+    for (unsigned int b = 0; b < KIDHASH_SIZE; ++b) {
+      struct info *in, *next;
+
+      for (in = p->p_kids[b]; in != NULL; in = next) {
+        bool dead;
+
+        next = in->i_hashnext;
+        spinlock_acquire(&in->i_lock);
+        in->parent = NULL;
+        dead = (in->ptr == NULL);
+        spinlock_release(&in->i_lock);
+
+        if (dead) {
+          proc_freepid(in->pid);
+          spinlock_cleanup(&in->i_lock);
+          kfree(in);
+        }
+      }
+      p->p_kids[b] = NULL;
+    }
+    p->p_nkids = 0;
+    p->p_zombies = p->p_zombies_tail = NULL;
+  }
 
-    //inform children and change ptr to NULL
-    //if there is children
-    unsigned int n = array_num(curproc->children);
+  /*
+   * A child started by vfork or spawn is on its own now (it has exec'd,
+   * or loaded its program), or failed to get going with ERR: let the
+   * parent, asleep in proc_waitlaunch, carry on. The parent cannot exit
+   * before then.
+   */
+  static
+  void
+  proc_launched(struct proc *p, int err)
+  {
+    struct info *me = p->parent;
+    struct proc *parent;
+
+    KASSERT(me != NULL);
+
+    spinlock_acquire(&me->i_lock);
+    parent = me->parent;
+    KASSERT(parent != NULL);
+    spinlock_acquire(&parent->p_lock);
+    me->i_launcherr = err;
+    me->i_launching = false;
+    wchan_wakeall(parent->p_wchan);
+    spinlock_release(&parent->p_lock);
+    spinlock_release(&me->i_lock);
+  }
 
-    for (unsigned int i = 0; i < n; ++i) {
-      struct info *in = array_get(curproc->children, i);
-      if (in->ptr != NULL) { //if children is not dead
-        KASSERT(in->ptr->parent != NULL);//if children has a parent
-        in->ptr->parent->ptr = NULL; //set dead flag on its children
+  /*
+   * Reap CHILD, whose launch failed, for spawn. Nobody else can:
+   * waitpid leaves it alone, as we never let go of i_launchref, and it
+   * is never queued for waitpid(-1). Unlike waitpid this does not
+   * give up if our process is exiting; the child is on its way out
+   * anyway.
+   */
+  static
+  void
+  proc_reapfailed(struct proc *p, struct info *child)
+  {
+    spinlock_acquire(&p->p_lock);
+    KASSERT(child->i_launchref);
+    KASSERT(child->i_launcherr != 0);
+    while (child->ptr != NULL) {
+      wchan_lock(p->p_wchan);
+      spinlock_release(&p->p_lock);
+      wchan_sleep(p->p_wchan);
+      spinlock_acquire(&p->p_lock);
+    }
+    usage_add(&p->p_cusage, &child->i_usage);
+    kid_remove(p, child);
+    //a waitpid(-1) may be waiting on it; see sys_waitpid
+    wchan_wakeall(p->p_wchan);
+    spinlock_release(&p->p_lock);
+
+    //the child may still be on its way out of i_lock; wait for that
+    spinlock_acquire(&child->i_lock);
+    spinlock_release(&child->i_lock);
+
+    proc_freepid(child->pid);
+    spinlock_cleanup(&child->i_lock);
+    kfree(child);
+  }
 
-      }else{//children is dead and the parent recycle the children
-        int unwanted_pid2 = in->pid;
-        pid_t* tmp = kmalloc(sizeof(int));
-       *tmp = unwanted_pid2;
-        array_add(pid_arr, tmp, NULL);
+  /*
+   * The other side of proc_launched. Until we are done reading CHILD it
+   * stays pinned (i_launchref), so another of our threads cannot reap
+   * and free it even if the child exits first. On success we let go of
+   * it, and queue it for waitpid if that happened; on failure we keep
+   * it for proc_reapfailed.
+   */
+  static
+  int
+  proc_waitlaunch(struct proc *p, struct info *child)
+  {
+    int err;
+
+    spinlock_acquire(&p->p_lock);
+    KASSERT(child->i_launchref);
+    while (child->i_launching) {
+      wchan_lock(p->p_wchan);
+      spinlock_release(&p->p_lock);
+      wchan_sleep(p->p_wchan);
+      spinlock_acquire(&p->p_lock);
+    }
+    err = child->i_launcherr;
+    if (err == 0) {
+      child->i_launchref = false;
+      if (child->ptr == NULL) {
+        //it already exited, and left queueing itself to us
+        kid_zombify(p, child);
       }
+      //a sibling thread may be waiting for it in waitpid
+      wchan_wakeall(p->p_wchan);
     }
-    lock_release(lk);
+    spinlock_release(&p->p_lock);
+    return err;
+  }
 
-    DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",exitcode);
+  /*
+   * Multithreaded processes. p_nthreads counts the threads that may run
+   * user code; p_nleaving the ones among them that have decided to exit
+   * but are not detached from the process yet. The process goes away
+   * with the last thread to decide (see sys_thread_exit), or with
+   * whichever thread calls _exit first, which waits for the rest.
+   */
 
-    KASSERT(curproc->p_addrspace != NULL);
-    as_deactivate();
-    /*
-     * clear p_addrspace before calling as_destroy. Otherwise if
-     * as_destroy sleeps (which is quite possible) when we
-     * come back we'll be calling as_activate on a
-     * half-destroyed address space. This tends to be
-     * messily fatal.
-     */
-    as = curproc_setas(NULL);
-    as_destroy(as);
+  /*
+   * The calling thread, already counted in p_nleaving, leaves the
+   * process, which is not going away before it has. STATUS is for
+   * thread_join.
+   */
+  static
+  void
+  uthread_leave(struct proc *p, int status)
+  {
+    struct uthread *ut;
+
+    spinlock_acquire(&p->p_lock);
+    for (ut = p->p_uthreads; ut != NULL; ut = ut->ut_next) {
+      if (ut->ut_thread == curthread) {
+        break;
+      }
+    }
+    spinlock_release(&p->p_lock);
+
+    //our user stack is free for the next thread_create
+    if (ut != NULL) {
+      as_release_tstack(p->p_addrspace, ut->ut_slot);
+    }
 
-    /* detach this thread from its process */
-    /* note: curproc cannot be used after this call */
     proc_remthread(curthread);
 
-    /* if this is the last user process in the system, proc_destroy()
-       will wake up the kernel menu thread */
+    spinlock_acquire(&p->p_lock);
+    if (ut != NULL) {
+      ut->ut_thread = NULL;
+      ut->ut_status = status;
+      ut->ut_done = true;
+    }
+    KASSERT(p->p_nthreads > 1);
+    KASSERT(p->p_nleaving > 0);
+    p->p_nthreads--;
+    p->p_nleaving--;
+    wchan_wakeall(p->p_wchan);
+    spinlock_release(&p->p_lock);
 
-    proc_destroy(p);
     thread_exit();
-    /* thread_exit() does not return, so we should never get here */
-    panic("return from thread_exit in sys_exit\n");
+    panic("return from thread_exit in uthread_leave\n");
   }
 
-  void sys__kill(int exitcode) {
-    lock_acquire(lk);
-    struct addrspace *as;
-    struct proc *p = curproc;
+  /*
+   * Get rid of every other thread in the process, for _exit and execv.
+   * They see p_exiting on their way back to user mode (proc_checkexit)
+   * or when they wake up in waitpid, thread_join, futex_wait or
+   * nanosleep; one blocked anywhere else in the kernel holds us up
+   * until it is done there. Returns false if another thread is doing
+   * this already, in which case the caller is one of the ones that have
+   * to go.
+   */
+  static
+  bool
+  proc_singlethread(struct proc *p)
+  {
+    struct thread *t;
+    unsigned i;
 
-    if((curproc->parent) != NULL) {//If one has a parent
-      if((curproc->parent->ptr) == NULL){ //If one has a parent and dead
-        //child exit and parent is dead
-        //it recycle itself
-        int unwanted_pid = curproc->pid;
-        pid_t* tmp = kmalloc(sizeof(int));
-       *tmp = unwanted_pid;
-        array_add(pid_arr, tmp, NULL);
-      }else if ((curproc->parent->ptr) != NULL){ //If one has a parent and alive
-        //inform parent and place return value if parent is still alive
-        //we use the lock of the object that we are changing it field
-        //we want to modify the parent's fields
-        struct array *p_children = curproc->parent->ptr->children;
-
-        unsigned int p_c_length = array_num(p_children);
-        //loop through the entire children
-        // 1. find the pid
-        // 2. change return value then exit
-        for (unsigned int i = 0; i < p_c_length; ++i) {
-          struct info *inf = array_get(p_children, i);
-          if ((inf->pid == curproc->pid)&&(inf->ptr != NULL)) {
-            inf->child_return = _MKWAIT_SIG(exitcode);
-            inf->ptr = NULL;
-            break;
-          }
+    spinlock_acquire(&p->p_lock);
+    if (p->p_exiting) {
+      spinlock_release(&p->p_lock);
+      return false;
+    }
+    p->p_exiting = true;
+    wchan_wakeall(p->p_wchan);
+    if (p->p_nthreads > 1) {
+      //and any that are in nanosleep
+      for (i = 0; i < threadarray_num(&p->p_threads); i++) {
+        t = threadarray_get(&p->p_threads, i);
+        if (t != curthread) {
+          clock_interrupt(t);
         }
-        //wake the parents that are still alive and
-        //waiting on parent its own lock
-        cv_broadcast(curproc->parent->ptr->p_cv, lk);
       }
+      //and any that are blocked on a futex
+      spinlock_release(&p->p_lock);
+      futex_wakeas(p->p_addrspace);
+      spinlock_acquire(&p->p_lock);
     }
+    while (p->p_nthreads > 1) {
+      wchan_lock(p->p_wchan);
+      spinlock_release(&p->p_lock);
+      wchan_sleep(p->p_wchan);
+      spinlock_acquire(&p->p_lock);
+    }
+    spinlock_release(&p->p_lock);
+    return true;
+  }
 
-    //inform children and change ptr to NULL
-    //if there is children
-    unsigned int n = array_num(curproc->children);
-
-    for (unsigned int i = 0; i < n; ++i) {
-      struct info *in = array_get(curproc->children, i);
-      if (in->ptr != NULL) { //if children is not dead
-        KASSERT(in->ptr->parent != NULL);//if children has a parent
-        in->ptr->parent->ptr = NULL; //set dead flag on its children
+  void proc_checkexit(void) {
+    struct proc *p = curproc;
 
-      }else{//children is dead and the parent recycle the children
-        int unwanted_pid2 = in->pid;
-        pid_t* tmp = kmalloc(sizeof(int));
-       *tmp = unwanted_pid2;
-        array_add(pid_arr, tmp, NULL);
-      }
+    spinlock_acquire(&p->p_lock);
+    if (!p->p_exiting) {
+      spinlock_release(&p->p_lock);
+      return;
     }
-    lock_release(lk);
+    p->p_nleaving++;
+    spinlock_release(&p->p_lock);
+    uthread_leave(p, 0);
+  }
 
-    DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",exitcode);
+  /*
+   * Common code for _exit() and death by signal.
+   */
+  static
+  void
+  proc_exit(int waitcode)
+  {
+    struct addrspace *as;
+    struct proc *p = curproc;
+
+    if (!proc_singlethread(p)) {
+      //somebody else is taking the process down already
+      proc_checkexit();
+    }
 
-    KASSERT(curproc->p_addrspace != NULL);
     as_deactivate();
     /*
      * clear p_addrspace before calling as_destroy. Otherwise if
@@ -171,12 +411,22 @@ void sys__exit(int exitcode) {
      * messily fatal.
      */
     as = curproc_setas(NULL);
-    as_destroy(as);
+    if (p->p_vforked) {
+      //borrowed from our parent: give it back rather than destroy it
+      p->p_vforked = false;
+      proc_launched(p, 0);
+    }else if (as != NULL) {
+      //(spawn children that failed to load never had one)
+      as_destroy(as);
+    }
 
     /* detach this thread from its process */
     /* note: curproc cannot be used after this call */
     proc_remthread(curthread);
 
+    //(after proc_remthread, so our own usage is in the total)
+    proc_exit_handoff(p, waitcode);
+
     /* if this is the last user process in the system, proc_destroy()
        will wake up the kernel menu thread */
 
@@ -186,340 +436,681 @@ void sys__exit(int exitcode) {
     panic("return from thread_exit in sys_exit\n");
   }
 
+  void sys__exit(int exitcode) {
+    DEBUG(DB_SYSCALL,"Syscall: _exit(%d)\n",exitcode);
+    proc_exit(_MKWAIT_EXIT(exitcode));
+  }
+
+  void sys__kill(int exitcode) {
+    DEBUG(DB_SYSCALL,"Killed: signal %d\n",exitcode);
+    proc_exit(_MKWAIT_SIG(exitcode));
+  }
+
+  /*
+   * waitpid. PID may be a child's pid or WAIT_ANY (WAIT_MYPGRP means the
+   * same thing, as there are no process groups). With WNOHANG, returns 0
+   * instead of sleeping if no matching child has exited yet.
+   */
   int sys_waitpid (pid_t pid,
               userptr_t status,
               int options,
               pid_t *retval)
   {
-    lock_acquire(lk);
     int exitstatus;
     int result;
+    struct proc *p = curproc;
+    struct info *ix;
+    bool any = (pid == WAIT_ANY || pid == WAIT_MYPGRP);
 
-    if (options != 0) {
+    if ((options & ~WNOHANG) != 0) {
       return(EINVAL);
     }
 
-    //parent use the cv of itself
-    struct cv* cv = NULL;
-    unsigned int num = array_num(curproc->children);
-    unsigned int i;
-    struct info* ix = NULL;
-    for (i = 0; i < num; ++i) {
-      ix = array_get(curproc->children, i);
-      if((ix->ptr == NULL)&&(ix->pid == pid)){
-        //if the children is already dead
-        //just get the exit code
-        exitstatus = ix->child_return;
-        break;
+    spinlock_acquire(&p->p_lock);
+    if (any) {
+      if (p->p_nkids == 0) {
+        spinlock_release(&p->p_lock);
+        return(ECHILD);
       }
-
-      else if(ix->pid == pid){
-        //otherwise the children is not dead yet
-        //note that parent is acquiring the lock of itself
-
-        cv = curproc->p_cv;
-        //if the children is not dead then
-          KASSERT(cv!=NULL);
-          while(ix->ptr != NULL){
-            //wait until child finish,
-            //sleep on parent its own cv, use parent its own lock
-            cv_wait(cv, lk);
-          }
-          exitstatus = ix->child_return;
-          //todo possible error in the future seem to be removable
-          struct info* infor = array_get(curproc->children, i);
-          kfree(infor);
-          array_remove(curproc->children, i);
-        //now the child is dead,
-        //find the exit code and exit
-        break;
+      ix = NULL;
+    }else{
+      ix = kid_lookup(p, pid);
+      if (ix == NULL || ix->i_launcherr != 0) {
+        spinlock_release(&p->p_lock);
+        return(ECHILD);
       }
     }
 
-    lock_release(lk);
-
-    result = copyout((void *)&exitstatus,status,sizeof(int));
-    if (result) {
-      return(result);
+    //until the child (or any child) has exited, sleep on parent its own
+    //wait channel, same dance as P(). A child still pinned by vfork or
+    //spawn is not ours to reap yet, and may turn out never to be.
+    while (any ? p->p_zombies == NULL : (ix->i_launchref || ix->ptr != NULL)) {
+      if (options & WNOHANG) {
+        spinlock_release(&p->p_lock);
+        *retval = 0;
+        return(0);
+      }
+      if (p->p_exiting) {
+        //another thread is exiting or exec'ing: let it
+        spinlock_release(&p->p_lock);
+        return(EINTR);
+      }
+      if (any && p->p_nkids == 0) {
+        //reaped from under us (by another thread, or by spawn)
+        spinlock_release(&p->p_lock);
+        return(ECHILD);
+      }
+      wchan_lock(p->p_wchan);
+      spinlock_release(&p->p_lock);
+      wchan_sleep(p->p_wchan);
+      spinlock_acquire(&p->p_lock);
+      if (!any) {
+        //spawn may have reaped it meanwhile; look it up again
+        ix = kid_lookup(p, pid);
+        if (ix == NULL || ix->i_launcherr != 0) {
+          spinlock_release(&p->p_lock);
+          return(ECHILD);
+        }
+      }
+    }
+    if (any) {
+      ix = p->p_zombies;
+    }
+    exitstatus = ix->child_return;
+    pid = ix->pid;
+    usage_add(&p->p_cusage, &ix->i_usage);
+    kid_remove(p, ix);
+    spinlock_release(&p->p_lock);
+
+    //the child may still be on its way out of i_lock; wait for that
+    spinlock_acquire(&ix->i_lock);
+    spinlock_release(&ix->i_lock);
+
+    //reaped: nobody can ask about this pid any more
+    proc_freepid(pid);
+    spinlock_cleanup(&ix->i_lock);
+    kfree(ix);
+
+    if (status != NULL) {
+      result = copyout((void *)&exitstatus,status,sizeof(int));
+      if (result) {
+        return(result);
+      }
     }
     *retval = pid;
     return(0);
   }
 
 
-  int sys_fork(struct trapframe *parent_tf, pid_t *retval){
-    //Create process structure for child process
-    struct proc * child_proc = proc_create_runprogram(curproc->p_name);
-    lock_acquire(lk);//todo
-    if(child_proc == NULL) panic("child_proc initialized failure.");
+  /*
+   * Make a new child of the current process that runs in address space
+   * AS and starts in ENTRY(DATA, 0). The child is linked into our child
+   * index before it can run; its handoff record is returned in RET.
+   * If BORROWED, AS is ours and the child must give it back rather than
+   * destroy it. If LAUNCHING, the child must call proc_launched once it
+   * is up. On error nothing has been created and AS is left to the
+   * caller.
+   */
+  static
+  int
+  proc_forkchild(struct addrspace *as, bool borrowed, bool launching,
+                 void (*entry)(void *, unsigned long), void *data,
+                 struct info **ret)
+  {
+    struct proc *p = curproc;
+    struct proc *child_proc;
+    struct info *child;
+    int result;
 
-    //Create and copy address space
-    //Attach the newly created address space to the child process structure
-    int ret_copy = as_copy(curproc_getas(), &(child_proc->p_addrspace));
-    if(ret_copy != 0){
+    //Create process structure for child process
+    child_proc = proc_create_runprogram(p->p_name);
+    if(child_proc == NULL){
+      //out of memory or out of pids
+      return ENPROC;
+    }
+    child_proc->p_addrspace = as;
+    child_proc->p_vforked = borrowed;
+
+    //create the parent/child relationship, shared by both sides
+    child = kmalloc(sizeof(struct info));
+    if(child == NULL){
+      child_proc->p_addrspace = NULL;
+      proc_unhash(child_proc);
+      proc_freepid(child_proc->pid);
       proc_destroy(child_proc);
-      panic("as_copy fails");
       return ENOMEM;
     }
+    child->pid = child_proc->pid;
+    child->ptr = child_proc;
+    child->parent = p;
+    child->child_return = 0;
+    child->i_launching = launching;
+    child->i_launcherr = 0;
+    child->i_launchref = launching;
+    spinlock_init(&child->i_lock);
 
-    //pid is generated in proc_create_runprogram
+    //add child for parent process
+    spinlock_acquire(&p->p_lock);
+    kid_add(p, child);
+    spinlock_release(&p->p_lock);
+    //add parent for child process
+    child_proc->parent = child;
 
+    //Create thread for child process
+    result = thread_fork(p->p_name, child_proc, entry, data, 0);
+    if(result){
+      //it never ran: take it back out as if it had been reaped
+      spinlock_acquire(&p->p_lock);
+      child->ptr = NULL;
+      kid_remove(p, child);
+      spinlock_release(&p->p_lock);
+      spinlock_cleanup(&child->i_lock);
+      kfree(child);
+      child_proc->parent = NULL;
+      child_proc->p_addrspace = NULL;
+      proc_unhash(child_proc);
+      proc_freepid(child_proc->pid);
+      proc_destroy(child_proc);
+      return result;
+    }
+    *ret = child;
+    return 0;
+  }
+
+  int sys_fork(struct trapframe *parent_tf, pid_t *retval){
+    struct addrspace *as;
+    struct info *child;
+    int result;
 
-   //create trapframe
+    //Create and copy address space
+    result = as_copy(curproc_getas(), &as);
+    if(result){
+      return result;
+    }
+
+    //the child returns to userlevel with a copy of our trapframe
     struct trapframe* tf = kmalloc(sizeof(struct trapframe));
-    if(tf==NULL) panic("trapframe kmalloc error");
+    if(tf==NULL){
+      as_destroy(as);
+      return ENOMEM;
+    }
     memcpy(tf, parent_tf, sizeof(struct trapframe));
 
-    //create the parent/child relationship
-    //create child and parent info objects
-    struct info* prt = kmalloc(sizeof(struct info));
-    struct info* child = kmalloc(sizeof(struct info));
-
+    result = proc_forkchild(as, false, false, (void *)enter_forked_process, tf, &child);
+    if(result){
+      kfree(tf);
+      as_destroy(as);
+      return result;
+    }
 
-    prt->pid = curproc->pid;
-    prt->ptr = curproc;
-    prt->child_return = 0;
+    //return value for parent is pid
+    *retval = child->pid;
+    return 0;
+  }
 
-    child->pid = child_proc->pid;
-    child->ptr = child_proc;
-    child->child_return = 0;
+  /*
+   * vfork: like fork, but the child runs in our address space instead
+   * of a copy of it, and we sleep until it has exec'd or exited. This
+   * makes fork-then-exec cost no more than the exec itself.
+   */
+  int sys_vfork(struct trapframe *parent_tf, pid_t *retval){
+    struct info *child;
+    pid_t pid;
+    int result;
 
-    //create children array for child process
-    if(child_proc->children == NULL){
-      panic("child_proc->children create failure from proc_syscalls.c");
+    struct trapframe* tf = kmalloc(sizeof(struct trapframe));
+    if(tf==NULL){
+      return ENOMEM;
     }
+    memcpy(tf, parent_tf, sizeof(struct trapframe));
 
-    //add child for parent process
-    int ret_addchild = array_add(curproc->children, child, NULL);
-    if(ret_addchild!=0){
-      panic("array_add add child to parent failed");
-      return ret_addchild;
+    result = proc_forkchild(curproc_getas(), true, true, (void *)enter_forked_process, tf, &child);
+    if(result){
+      kfree(tf);
+      return result;
     }
-    //add parent for child process
-    child_proc->parent = prt;
-    lock_release(lk);
-    //Create thread for child process
-    //(need a safe way to pass the trapframe to the child thread).
-    int ret_threadf = thread_fork(curproc->p_name, child_proc, (void *)enter_forked_process, tf, 0);
-    if(ret_threadf != 0){
-        kfree(tf);
-        proc_destroy(child_proc);
-        panic("thread_fork error");
-        return ret_threadf;
-    }else{
-      *retval = child_proc->pid;
-      //otherwise return value for parent is pid
-    }
-    //lock_release(lk);
+    //another of our threads may reap the child as soon as it has let go
+    pid = child->pid;
+
+    //wait for our address space to come back
+    proc_waitlaunch(curproc, child);
+
+    *retval = pid;
     return 0;
   }
 
   int sys_getpid(pid_t *retval) {
-    /* for now, this is just a stub that always returns a PID of 1 */
-    /* you need to fix this to make it work properly */
-    lock_acquire(lk);
+    /* the pid never changes once assigned, so no locking needed */
     *retval = curproc->pid;
-    lock_release(lk);
     return 0;
   }
 
 
-  //todo
-  //todo
-    //todo
-  //todo
-    //todo
-  //todo
-  int sys_execv(const char *program, char **args){
-        //lock_acquire(lk);
-        int exception;
+  /*
+   * getrusage. RUSAGE_SELF covers every thread of ours, running or not;
+   * RUSAGE_CHILDREN covers the children we have reaped with waitpid,
+   * and in turn theirs.
+   */
+  int sys_getrusage(int who, userptr_t usage) {
+    struct proc *p = curproc;
+    struct usage u;
+    struct rusage ru;
+
+    spinlock_acquire(&p->p_lock);
+    if (who == RUSAGE_SELF) {
+      u = p->p_usage;
+      for (unsigned i = 0; i < threadarray_num(&p->p_threads); i++) {
+        usage_add(&u, &threadarray_get(&p->p_threads, i)->t_usage);
+      }
+    }else if (who == RUSAGE_CHILDREN) {
+      u = p->p_cusage;
+    }else{
+      spinlock_release(&p->p_lock);
+      return EINVAL;
+    }
+    spinlock_release(&p->p_lock);
+
+    bzero(&ru, sizeof(ru));
+    ru.ru_utime.tv_sec = u.u_uticks / HZ;
+    ru.ru_utime.tv_usec = (u.u_uticks % HZ) * (1000000 / HZ);
+    ru.ru_stime.tv_sec = u.u_sticks / HZ;
+    ru.ru_stime.tv_usec = (u.u_sticks % HZ) * (1000000 / HZ);
+    ru.ru_minflt = u.u_minflt;
+    ru.ru_nvcsw = u.u_nvcsw;
+    ru.ru_nivcsw = u.u_nivcsw;
+    ru.ru_nsyscalls = u.u_nsyscalls;
+    ru.ru_nmigrations = u.u_nmigrations;
+    ru.ru_wtime.tv_sec = u.u_waitns / 1000000000;
+    ru.ru_wtime.tv_usec = u.u_waitns % 1000000000 / 1000;
+    return copyout(&ru, usage, sizeof(ru));
+  }
 
-        //1. Count the number of arguments
-        int args_num = 0;
-        int index = 0;
-        while(args[index]!=NULL){
-                index++;
-        }
-        args_num = index;
+  /*
+   * getpriority/setpriority. Only PRIO_PROCESS is supported, since
+   * there are no process groups or users; WHO is a pid, or 0 for us.
+   * Out-of-range values are clamped, as elsewhere. The nice value
+   * picks the process's place in the scheduler, see thread_floor.
+   */
+  static
+  int
+  prio_target(int which, int who, pid_t *pid)
+  {
+    if (which != PRIO_PROCESS) {
+      return EINVAL;
+    }
+    *pid = (who == 0) ? curproc->pid : who;
+    return 0;
+  }
 
-        //2. copy them into the kernel
-        char** args_kernel = kmalloc(sizeof(char*) * (args_num + 1));
-        if(args_kernel==NULL){//mem error1
-                return ENOMEM;
-        }
+  int sys_getpriority(int which, int who, int *retval) {
+    pid_t pid;
+    int result;
 
-        for(int i = 0; i<=args_num; i++){
-              if(i != args_num){
-                      int args_size = strlen(args[i]) + 1;
-                      args_kernel[i] = kmalloc(sizeof(char) * args_size);
-                       if(args_kernel[i]==NULL){//mem error2
-                              for(; i>=0; i--){
-                                kfree(args_kernel[i]);
-                              }
-                              kfree(args_kernel);
-                              return ENOMEM;
-                       }
-
-                       exception = copyinstr((const_userptr_t) args[i], args_kernel[i], args_size, NULL);
-                       if(exception){//mem error3
-                          for(; i>=0; i--){
-                                kfree(args_kernel[i]);
-                              }
-                              kfree(args_kernel);
-                              return exception;
-                       }
-              }else{
-                args_kernel[i] = NULL;
-              }
-        }
+    result = prio_target(which, who, &pid);
+    if (result) {
+      return result;
+    }
+    return proc_getnice(pid, retval);
+  }
 
-        //3. Copy the program path into the kernel
-        int ppath_len = strlen(program) + 1;
-        int ppath_size = sizeof(char) * ppath_len;
-        char* ppath = kmalloc(ppath_size);
-        if(ppath == NULL){//mem error4
-            for(int i=args_num; i>=0; i--){
-              kfree(args_kernel[i]);
-            }
-            kfree(args_kernel);
+  int sys_setpriority(int which, int who, int prio) {
+    pid_t pid;
+    int result;
+
+    result = prio_target(which, who, &pid);
+    if (result) {
+      return result;
+    }
+    if (prio < PRIO_MIN) {
+      prio = PRIO_MIN;
+    }else if (prio > PRIO_MAX - 1) {
+      prio = PRIO_MAX - 1;
+    }
+    return proc_setnice(pid, prio);
+  }
+
+  /* Copy the program path in from userland. Free it with kfree. */
+  static
+  int
+  path_copyin(const char *program, char **ret)
+  {
+        int exception;
+        char* ppath = kmalloc(PATH_MAX);
+        if(ppath == NULL){
             return ENOMEM;
         }
 
-        exception = copyinstr((const_userptr_t) program, ppath, ppath_len, NULL);
-        if(exception){//mem error 5
+        exception = copyinstr((const_userptr_t) program, ppath, PATH_MAX, NULL);
+        if(exception){
           kfree(ppath);
-          for(int i=args_num; i>=0; i--){
-              kfree(args_kernel[i]);
-            }
-            kfree(args_kernel);
-            return exception;
+          return exception;
         }
+        *ret = ppath;
+        return 0;
+  }
 
-        //follow pattern of runprogram.c
-        struct addrspace* as;
-        struct vnode* v;
+  int sys_execv(const char *program, char **args){
+        struct proc *p = curproc;
+        struct addrspace* as_old;
+        struct argbuf ab;
         vaddr_t entrypoint, stackptr;
-        //4. Open the program file using
-        exception = vfs_open((char *) ppath, O_RDONLY, 0, &v);
-	if (exception) {
-	    kfree(ppath);
-            for(int i=args_num; i>=0; i--){
-              kfree(args_kernel[i]);
-            }
-            kfree(args_kernel);
+        userptr_t argv;
+        int argc;
+        char *ppath;
+        int exception;
+
+        //1. copy the args and the program path into the kernel
+        argbuf_init(&ab);
+        exception = argbuf_copyin(&ab, (userptr_t)args);
+        if(exception){
             return exception;
-	}
-
-	//5. Create new address space
-	as = as_create();
-	if (as ==NULL) {
-		vfs_close(v);
-		kfree(ppath);
-                for(int i=args_num; i>=0; i--){
-                  kfree(args_kernel[i]);
-                }
-                kfree(args_kernel);
-                return ENOMEM;
-	}
-
-	//6. set process to the new address space, and activate it
-	struct addrspace* as_old = curproc_getas();
-	curproc_setas(as);
-	as_activate();
-
-	//6. Using the opened program file, load the program image using load_elf
-        exception = load_elf(v, &entrypoint);
+        }
+        exception = path_copyin(program, &ppath);
         if(exception){
-                vfs_close(v);
-                kfree(ppath);
-
-                //as_deactivate();//yet implemented
-                curproc_setas(as_old);
-                as_destroy(as);
-
-                for(int i=args_num; i>=0; i--){
-                  kfree(args_kernel[i]);
-                }
-                kfree(args_kernel);
-                return exception;
+            argbuf_cleanup(&ab);
+            return exception;
+        }
+
+        //2. we are about to pull the address space out from under any
+        //other threads, so they go first (even if the exec then fails)
+        if(!proc_singlethread(p)){
+            kfree(ppath);
+            argbuf_cleanup(&ab);
+            proc_checkexit();
         }
 
-        //7. Done with the file, program path
-	vfs_close(v);
+        //3. load the program into a new address space and switch to it
+        exception = loadprogram(ppath, &ab, &as_old,
+                                &argc, &argv, &stackptr, &entrypoint);
         kfree(ppath);
+        argbuf_cleanup(&ab);
+        spinlock_acquire(&p->p_lock);
+        p->p_exiting = false;
+        if(exception){
+            spinlock_release(&p->p_lock);
+            return exception;
+        }
+        //thread ids (ours included) belong to the old image
+        struct uthread *ut = p->p_uthreads;
+        p->p_uthreads = NULL;
+        spinlock_release(&p->p_lock);
+        while(ut != NULL){
+            struct uthread *next = ut->ut_next;
+            kfree(ut);
+            ut = next;
+        }
 
-        //8. define stack
-        exception = as_define_stack(as, &stackptr);
+        //4. get rid of the old address space: give it back if it was only
+        //borrowed through vfork
+        if(p->p_vforked){
+            p->p_vforked = false;
+            proc_launched(p, 0);
+        }else{
+            as_destroy(as_old);
+        }
+
+        //5. enter new process
+        enter_new_process(argc, argv, stackptr, entrypoint);
+
+        panic("enter_new_process failed");
+        return EINVAL;
+  }
+
+  /* what a spawned child runs: see sys_spawn */
+  struct spawn_entry {
+    char *path;
+    struct argbuf args;
+  };
+
+  static
+  void
+  enter_spawned_process(void *data, unsigned long unused)
+  {
+    struct spawn_entry *se = data;
+    struct addrspace *as_old;
+    vaddr_t entrypoint, stackptr;
+    userptr_t argv;
+    int argc;
+    int result;
+
+    (void)unused;
+    result = loadprogram(se->path, &se->args, &as_old,
+                         &argc, &argv, &stackptr, &entrypoint);
+    kfree(se->path);
+    argbuf_cleanup(&se->args);
+    kfree(se);
+
+    proc_launched(curproc, result);
+    if (result) {
+      //our parent reaps us and reports the error
+      proc_exit(_MKWAIT_EXIT(1));
+    }
+    KASSERT(as_old == NULL);
+    enter_new_process(argc, argv, stackptr, entrypoint);
+  }
+
+  /*
+   * spawn: start PROGRAM with ARGS in a new child process and return its
+   * pid, i.e. fork+execv without ever copying our address space. The
+   * child loads the program itself, so our own address space is never
+   * touched (other threads of ours may be running in it), but we wait
+   * for the load so any error comes back from spawn itself rather than
+   * as the child's exit status.
+   */
+  int sys_spawn(const char *program, char **args, pid_t *retval){
+        struct spawn_entry *se;
+        struct info *child;
+        pid_t pid;
+        int exception;
+
+        se = kmalloc(sizeof(struct spawn_entry));
+        if(se == NULL){
+            return ENOMEM;
+        }
+        argbuf_init(&se->args);
+        exception = argbuf_copyin(&se->args, (userptr_t)args);
         if(exception){
-              //as_deactivate();//yet implemented
-              curproc_setas(as_old);
-              as_destroy(as);
-
-              for(int i=args_num; i>=0; i--){
-                kfree(args_kernel[i]);
-              }
-              kfree(args_kernel);
-              return exception;
+            kfree(se);
+            return exception;
+        }
+        exception = path_copyin(program, &se->path);
+        if(exception){
+            argbuf_cleanup(&se->args);
+            kfree(se);
+            return exception;
         }
 
-        //9. copy the args into the new address space
-        vaddr_t ptr[args_num+1];
-
-        for(int j = args_num-1; j>=0; j--){
-          int len = strlen(args_kernel[j]) + 1;
-          stackptr = stackptr - ROUNDUP(len, 8);
-          exception = copyoutstr(args_kernel[j], (userptr_t) stackptr, ROUNDUP(len, 8), NULL);
-          if(exception){
-            //as_deactivate();//yet implemented
-              curproc_setas(as_old);
-              as_destroy(as);
-
-              for(int i=args_num; i>=0; i--){
-                kfree(args_kernel[i]);
-              }
-              kfree(args_kernel);
-              return exception;
-          }
-          ptr[j] = stackptr;
+        exception = proc_forkchild(NULL, false, true, enter_spawned_process, se, &child);
+        if(exception){
+            kfree(se->path);
+            argbuf_cleanup(&se->args);
+            kfree(se);
+            return exception;
         }
-        ptr[args_num] = (vaddr_t) NULL;
-
-        //10. copy the args's ptr into the new address space
-        for(int j = args_num; j>=0; j--){
-          stackptr = stackptr - ROUNDUP(sizeof(vaddr_t), 4);
-          exception = copyout((void *) &ptr[j], (userptr_t) stackptr, ROUNDUP(sizeof(vaddr_t), 4));
-           if(exception){
-            //as_deactivate();//yet implemented
-              curproc_setas(as_old);
-              as_destroy(as);
-
-              for(int i=args_num; i>=0; i--){
-                kfree(args_kernel[i]);
-              }
-              kfree(args_kernel);
-              return exception;
-          }
+        pid = child->pid;
+
+        exception = proc_waitlaunch(curproc, child);
+        if(exception){
+            //it is on its way out: make sure nobody ever sees it
+            proc_reapfailed(curproc, child);
+            return exception;
         }
 
-        //we force the used stack amount to be multiplier of 8
-        vaddr_t args_ptr = stackptr;
-        stackptr = stackptr - (8 - ((USERSTACK - stackptr) % 8));
+        *retval = pid;
+        return 0;
+  }
 
-        //11. Delete old address space and unneed ptrs
-        as_destroy(as_old);
+  /*
+   * Where a thread from thread_create starts: registers and stack were
+   * set up by sys_thread_create.
+   */
+  static
+  void
+  uthread_start(void *data1, unsigned long data2)
+  {
+    struct uthread *ut = data1;
+    struct trapframe *tf = (struct trapframe *)data2;
+    struct proc *p = curproc;
 
-        for(int i=args_num; i>=0; i--){
-          kfree(args_kernel[i]);
-        }
-        kfree(args_kernel);
+    spinlock_acquire(&p->p_lock);
+    ut->ut_thread = curthread;
+    spinlock_release(&p->p_lock);
 
-        //lock_release(lk);
-        //12 enter new process
-        enter_new_process(args_num, (userptr_t) args_ptr,
-                stackptr, entrypoint);
+    //don't bother if the process is going away already
+    if (p->p_exiting) {
+      kfree(tf);
+      proc_checkexit();
+    }
+    enter_user_thread(tf);
+  }
 
-        panic("enter_new_process failed");
-        return EINVAL;
+  static
+  void
+  uthread_unlink(struct proc *p, struct uthread *ut)
+  {
+    struct uthread **pp;
+
+    KASSERT(spinlock_do_i_hold(&p->p_lock));
+    for (pp = &p->p_uthreads; *pp != ut; pp = &(*pp)->ut_next) {
+      KASSERT(*pp != NULL);
+    }
+    *pp = ut->ut_next;
+  }
+
+  /*
+   * thread_create: start another thread in this process, on its own
+   * user stack, running START(FUNC, ARG). START is the library's
+   * trampoline, which calls FUNC(ARG) and then thread_exit. Returns the
+   * new thread's id, for thread_join.
+   */
+  int sys_thread_create(struct trapframe *parent_tf, userptr_t start,
+                        userptr_t func, userptr_t arg, int *retval){
+    struct proc *p = curproc;
+    struct addrspace *as = curproc_getas();
+    struct trapframe *tf;
+    struct uthread *ut;
+    vaddr_t stackptr;
+    int tid;
+    int result;
+
+    ut = kmalloc(sizeof(struct uthread));
+    if(ut == NULL){
+      return ENOMEM;
+    }
+    tf = kmalloc(sizeof(struct trapframe));
+    if(tf == NULL){
+      kfree(ut);
+      return ENOMEM;
+    }
+    result = as_define_tstack(as, &stackptr, &ut->ut_slot);
+    if(result){
+      kfree(tf);
+      kfree(ut);
+      return result;
+    }
+
+    //our registers (for $gp), except for where it starts
+    memcpy(tf, parent_tf, sizeof(struct trapframe));
+    tf->tf_epc = (vaddr_t)start;
+    tf->tf_a0 = (vaddr_t)func;
+    tf->tf_a1 = (vaddr_t)arg;
+    tf->tf_sp = stackptr;
+    tf->tf_ra = 0;
+
+    ut->ut_thread = NULL;
+    ut->ut_done = false;
+    ut->ut_joined = false;
+    ut->ut_status = 0;
+
+    spinlock_acquire(&p->p_lock);
+    tid = ut->ut_tid = p->p_nexttid++;
+    ut->ut_next = p->p_uthreads;
+    p->p_uthreads = ut;
+    p->p_nthreads++;
+    spinlock_release(&p->p_lock);
+
+    result = thread_fork(p->p_name, p, uthread_start, ut, (unsigned long)tf);
+    if(result){
+      spinlock_acquire(&p->p_lock);
+      uthread_unlink(p, ut);
+      p->p_nthreads--;
+      wchan_wakeall(p->p_wchan);
+      spinlock_release(&p->p_lock);
+      as_release_tstack(as, ut->ut_slot);
+      kfree(tf);
+      kfree(ut);
+      return result;
+    }
+
+    //(ut may be gone already)
+    *retval = tid;
+    return 0;
+  }
+
+  /*
+   * thread_exit: the calling thread is done. If it is the last one, the
+   * process exits with status 0.
+   */
+  void sys_thread_exit(int status){
+    struct proc *p = curproc;
+
+    spinlock_acquire(&p->p_lock);
+    if (p->p_nthreads - p->p_nleaving == 1 && !p->p_exiting) {
+      spinlock_release(&p->p_lock);
+      proc_exit(_MKWAIT_EXIT(0));
+    }
+    p->p_nleaving++;
+    spinlock_release(&p->p_lock);
+    uthread_leave(p, status);
+  }
+
+  /*
+   * thread_join: wait for thread TID of this process to exit and
+   * collect its thread_exit status. Each thread can be joined once, and
+   * not by itself.
+   */
+  int sys_thread_join(int tid, userptr_t status){
+    struct proc *p = curproc;
+    struct uthread *ut;
+    int exitstatus;
+
+    spinlock_acquire(&p->p_lock);
+    for (ut = p->p_uthreads; ut != NULL; ut = ut->ut_next) {
+      if (ut->ut_tid == tid) {
+        break;
+      }
+    }
+    if (ut == NULL) {
+      spinlock_release(&p->p_lock);
+      return ESRCH;
+    }
+    if (ut->ut_thread == curthread || ut->ut_joined) {
+      spinlock_release(&p->p_lock);
+      return EINVAL;
+    }
+    ut->ut_joined = true;
+
+    while (!ut->ut_done) {
+      if (p->p_exiting) {
+        //another thread is exiting or exec'ing: let it
+        ut->ut_joined = false;
+        spinlock_release(&p->p_lock);
+        return EINTR;
+      }
+      wchan_lock(p->p_wchan);
+      spinlock_release(&p->p_lock);
+      wchan_sleep(p->p_wchan);
+      spinlock_acquire(&p->p_lock);
+    }
+    exitstatus = ut->ut_status;
+    uthread_unlink(p, ut);
+    spinlock_release(&p->p_lock);
+    kfree(ut);
+
+    if (status != NULL) {
+      return copyout(&exitstatus, status, sizeof(int));
+    }
+    return 0;
   }
 
 
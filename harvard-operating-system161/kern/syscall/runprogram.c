@@ -45,41 +45,37 @@
 #include <test.h>
 #include <syscall.h>
 #include <copyinout.h>
+#include <argbuf.h>
 #include "opt-A2.h"
 
 #if OPT_A2
 
 /*
- * Load program "progname" and start running it in usermode.
- * Does not return except on error.
+ * Load program "progname" into a fresh address space and lay ARGS out
+ * on its stack, all set up for enter_new_process(). On success the new
+ * address space is the current one and the address space it replaced
+ * is returned in OLDAS; what to do with that is up to the caller. On
+ * error the old address space is put back. Either way ARGS is used up
+ * and only good for argbuf_cleanup.
+ *
+ * Shared by runprogram, execv and spawn.
  *
  * Calls vfs_open on progname and thus may destroy it.
  */
 int
-runprogram(char *progname, char** args)
+loadprogram(char *progname, struct argbuf *args, struct addrspace **oldas,
+	    int *argc, userptr_t *argv, vaddr_t *stackptr, vaddr_t *entrypoint)
 {
-	struct addrspace *as;
+	struct addrspace *as, *old;
 	struct vnode *v;
-	vaddr_t entrypoint, stackptr;
 	int result;
 
-	//Count the number of arguments
-	int args_num = 0;
-        int index = 0;
-        while(args[index]!=NULL){
-                index++;
-        }
-        args_num = index;
-
 	/* Open the file. */
 	result = vfs_open(progname, O_RDONLY, 0, &v);
 	if (result) {
 		return result;
 	}
 
-	/* We should be a new process. */
-	KASSERT(curproc_getas() == NULL);
-
 	/* Create a new address space. */
 	as = as_create();
 	if (as ==NULL) {
@@ -88,59 +84,77 @@ runprogram(char *progname, char** args)
 	}
 
 	/* Switch to it and activate it. */
-	curproc_setas(as);
+	old = curproc_setas(as);
 	as_activate();
 
 	/* Load the executable. */
-	result = load_elf(v, &entrypoint);
-	if (result){
-		/* p_addrspace will go away when curproc is destroyed */
-		vfs_close(v);
-		return result;
-	}
+	result = load_elf(v, entrypoint);
 
 	/* Done with the file now. */
 	vfs_close(v);
+	if (result){
+		goto fail;
+	}
 
 	/* Define the user stack in the address space */
-	result = as_define_stack(as, &stackptr);
+	result = as_define_stack(as, stackptr);
 	if (result) {
-		/* p_addrspace will go away when curproc is destroyed */
-		return result;
+		goto fail;
+	}
+
+	/* Copy the arguments onto the stack */
+	result = argbuf_copyout(args, stackptr, argv);
+	if (result) {
+		goto fail;
 	}
+	*argc = args->ab_argc;
 
-	int exception;
-	//copy the args into the new address space
-	vaddr_t ptr[args_num+1];
-	for(int j = args_num-1; j>=0; j--){
-          int len = strlen(args[j]) + 1;
-          stackptr = stackptr - ROUNDUP(len, 8);
-          exception = copyoutstr(args[j], (userptr_t) stackptr, ROUNDUP(len, 8), NULL);
-          if(exception){
-              return exception;
-          }
-          ptr[j] = stackptr;
-        }
-        ptr[args_num] = (vaddr_t) NULL;
+	*oldas = old;
+	return 0;
 
-	//copy the args's ptr into the new address space
+ fail:
+	/* put things back the way they were */
+	curproc_setas(old);
+	as_activate();
+	as_destroy(as);
+	return result;
+}
 
+/*
+ * Load program "progname" and start running it in usermode.
+ * Does not return except on error.
+ *
+ * Calls vfs_open on progname and thus may destroy it.
+ */
+int
+runprogram(char *progname, char** args)
+{
+	struct addrspace *oldas;
+	struct argbuf ab;
+	vaddr_t entrypoint, stackptr;
+	userptr_t argv;
+	int argc;
+	int result;
 
-	for(int j = args_num; j>=0; j--){
-          stackptr = stackptr - ROUNDUP(sizeof(vaddr_t), 4);
-          exception = copyout((void *) &ptr[j], (userptr_t) stackptr, ROUNDUP(sizeof(vaddr_t), 4));
-           if(exception){
-              return exception;
-          }
-     }
+	/* We should be a new process. */
+	KASSERT(curproc_getas() == NULL);
 
+	argbuf_init(&ab);
+	result = argbuf_kcopy(&ab, args);
+	if (result) {
+		return result;
+	}
 
-    	//we force the used stack amount to be multiplier of 8
-        vaddr_t args_ptr = stackptr;
-        stackptr = stackptr - (8 - ((USERSTACK - stackptr) % 8));
+	result = loadprogram(progname, &ab, &oldas,
+			     &argc, &argv, &stackptr, &entrypoint);
+	argbuf_cleanup(&ab);
+	if (result) {
+		return result;
+	}
+	KASSERT(oldas == NULL);
 
 	/* Warp to user mode. */
-	enter_new_process(args_num, (userptr_t) args_ptr /*userspace addr of argv*/,
+	enter_new_process(argc, argv /*userspace addr of argv*/,
 			  stackptr, entrypoint);
 
 	/* enter_new_process does not return. */
@@ -28,6 +28,7 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <bitmap.h>
 #include <test.h>
@@ -101,6 +102,28 @@ bitmaptest(int nargs, char **args)
 		KASSERT(data[i]==0);
 	}
 
+	/* Next-fit: free a few bits and make sure we get them back in order */
+	bitmap_unmark(b, 7);
+	bitmap_unmark(b, 300);
+	bitmap_unmark(b, TESTSIZE-1);
+	KASSERT(bitmap_alloc_from(b, 100, &x)==0);
+	KASSERT(x == 300);
+	KASSERT(bitmap_alloc_from(b, x+1, &x)==0);
+	KASSERT(x == TESTSIZE-1);
+	/* starting past the end goes back to bit 0 */
+	KASSERT(bitmap_alloc_from(b, x+1, &x)==0);
+	KASSERT(x == 7);
+	KASSERT(bitmap_alloc_from(b, x+1, &x)==ENOSPC);
+	/* starting inside the map, this one has to wrap around */
+	bitmap_unmark(b, 70);
+	KASSERT(bitmap_alloc_from(b, 400, &x)==0);
+	KASSERT(x == 70);
+	/* ...back to the low bits of the word it started in */
+	bitmap_unmark(b, 5);
+	KASSERT(bitmap_alloc_from(b, 20, &x)==0);
+	KASSERT(x == 5);
+	KASSERT(bitmap_alloc_from(b, 20, &x)==ENOSPC);
+
 	kprintf("Bitmap test complete\n");
 	return 0;
 }
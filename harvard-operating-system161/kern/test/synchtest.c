@@ -34,7 +34,9 @@
 #include <types.h>
 #include <lib.h>
 #include <clock.h>
+#include <cpu.h>
 #include <thread.h>
+#include <current.h>
 #include <synch.h>
 #include <test.h>
 
@@ -347,3 +349,723 @@ cvtest(int nargs, char **args)
 
 	return 0;
 }
+
+/*
+ * CV broadcast benchmark. NTHREADS threads wait on testcv; each round
+ * we broadcast with testlock held, and each waiter then holds the lock
+ * for a little while. Reported are the context switches, on all cpus,
+ * per broadcast, and how often a waiter had to go back to sleep on the
+ * lock after being woken from the cv. With wait morphing (see
+ * cv_broadcast) the latter should be about zero; otherwise most of
+ * the herd wakes up only to queue on the lock again.
+ */
+#define NCVBENCHROUNDS	20
+
+static struct cv *benchcv;		/* the benchmark thread waits here */
+static volatile unsigned long benchgen;	/* rounds broadcast so far */
+
+static
+unsigned
+cvbench_switches(void)
+{
+	struct cpu *c;
+	unsigned i, n = 0;
+
+	for (i=0; (c = cpu_get(i)) != NULL; i++) {
+		n += c->c_stats.ss_nswitch;
+	}
+	return n;
+}
+
+static
+void
+cvbenchthread(void *junk, unsigned long num)
+{
+	unsigned long r;
+	uint32_t before;
+	volatile int j;
+
+	(void)junk;
+	(void)num;
+
+	for (r=0; r<NCVBENCHROUNDS; r++) {
+		lock_acquire(testlock);
+		if (++testval1 == NTHREADS * (r + 1)) {
+			cv_signal(benchcv, testlock);
+		}
+		before = curthread->t_usage.u_nvcsw;
+		while (benchgen == r) {
+			cv_wait(testcv, testlock);
+		}
+		/* one sleep is on the cv; any more were on the lock */
+		if (curthread->t_usage.u_nvcsw - before > 1) {
+			testval3 += curthread->t_usage.u_nvcsw - before - 1;
+		}
+		for (j=0; j<1000; j++);
+		if (++testval2 == NTHREADS * (r + 1)) {
+			cv_signal(benchcv, testlock);
+		}
+		lock_release(testlock);
+	}
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+int
+cvbench(int nargs, char **args)
+{
+	unsigned long r;
+	unsigned start, switches = 0;
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	benchcv = cv_create("benchcv");
+	if (benchcv == NULL) {
+		panic("cvbench: cv_create failed\n");
+	}
+	kprintf("Starting CV broadcast benchmark...\n");
+
+	testval1 = testval2 = testval3 = 0;
+	benchgen = 0;
+	for (i=0; i<NTHREADS; i++) {
+		result = thread_fork("cvbench", NULL, cvbenchthread, NULL, i);
+		if (result) {
+			panic("cvbench: thread_fork failed: %s\n",
+			      strerror(result));
+		}
+	}
+
+	lock_acquire(testlock);
+	for (r=0; r<NCVBENCHROUNDS; r++) {
+		/* wait for everyone to be asleep on the cv */
+		while (testval1 < NTHREADS * (r + 1)) {
+			cv_wait(benchcv, testlock);
+		}
+		start = cvbench_switches();
+		benchgen++;
+		cv_broadcast(testcv, testlock);
+
+		/* ...and for everyone to have been through the lock */
+		while (testval2 < NTHREADS * (r + 1)) {
+			cv_wait(benchcv, testlock);
+		}
+		switches += cvbench_switches() - start;
+	}
+	lock_release(testlock);
+
+	for (i=0; i<NTHREADS; i++) {
+		P(donesem);
+	}
+
+	kprintf("%d waiters: %u context switches per broadcast, "
+		"%lu sleeps on the lock after wakeup in all\n", NTHREADS,
+		switches / NCVBENCHROUNDS, testval3);
+
+	cv_destroy(benchcv);
+	benchcv = NULL;
+#ifdef UW
+  cleanitems();
+#endif
+	kprintf("CV broadcast benchmark done\n");
+
+	return 0;
+}
+
+/*
+ * Reader-writer lock tests. Both run with the sleeping rwlock and
+ * then with the rwspinlock.
+ *
+ * rwtest: one thread in four writes, the rest read. A writer sets
+ * testval1 and, a little later, testval2, to its number; readers must
+ * never see them differ, and writers must never see a reader inside.
+ *
+ * rwbench: throughput of a read-mostly load (one write in
+ * RWBENCHWRITE operations) under a plain lock and under each kind of
+ * rwlock. Readers can overlap only with the latter, so on more than
+ * one cpu they should get through more operations per millisecond.
+ */
+#define NRWLOOPS	200
+#define RWBENCHTHREADS	8
+#define RWBENCHOPS	2000
+#define RWBENCHWRITE	16
+
+static struct rwlock *testrw;
+static struct rwspinlock testrws = RWSPINLOCK_INITIALIZER;
+static struct spinlock rwtest_lock = SPINLOCK_INITIALIZER;
+static volatile unsigned rwtest_readers;	/* readers inside */
+static volatile unsigned rwtest_failures;
+static int rwtest_mode;
+
+#define RWMODE_LOCK	0	/* rwbench only */
+#define RWMODE_SLEEP	1
+#define RWMODE_SPIN	2
+
+static
+void
+rw_enter(bool write)
+{
+	switch (rwtest_mode) {
+	    case RWMODE_LOCK:
+		lock_acquire(testlock);
+		break;
+	    case RWMODE_SLEEP:
+		if (write) {
+			rwlock_acquire_write(testrw);
+		}
+		else {
+			rwlock_acquire_read(testrw);
+		}
+		break;
+	    case RWMODE_SPIN:
+		if (write) {
+			rwspinlock_acquire_write(&testrws);
+		}
+		else {
+			rwspinlock_acquire_read(&testrws);
+		}
+		break;
+	}
+}
+
+static
+void
+rw_exit(bool write)
+{
+	switch (rwtest_mode) {
+	    case RWMODE_LOCK:
+		lock_release(testlock);
+		break;
+	    case RWMODE_SLEEP:
+		if (write) {
+			rwlock_release_write(testrw);
+		}
+		else {
+			rwlock_release_read(testrw);
+		}
+		break;
+	    case RWMODE_SPIN:
+		if (write) {
+			rwspinlock_release_write(&testrws);
+		}
+		else {
+			rwspinlock_release_read(&testrws);
+		}
+		break;
+	}
+}
+
+static
+void
+rwfail(unsigned long num, const char *msg)
+{
+	kprintf("thread %lu: %s\n", num, msg);
+	spinlock_acquire(&rwtest_lock);
+	rwtest_failures++;
+	spinlock_release(&rwtest_lock);
+}
+
+static
+void
+rwtestthread(void *junk, unsigned long num)
+{
+	bool write = (num % 4 == 0);
+	volatile int j;
+	int i;
+
+	(void)junk;
+
+	for (i=0; i<NRWLOOPS; i++) {
+		rw_enter(write);
+		if (write) {
+			if (rwtest_readers != 0) {
+				rwfail(num, "writer ran with readers inside");
+			}
+			testval1 = num;
+			for (j=0; j<100; j++);
+			testval2 = num;
+			if (testval1 != num) {
+				rwfail(num, "writer ran with another writer");
+			}
+		}
+		else {
+			spinlock_acquire(&rwtest_lock);
+			rwtest_readers++;
+			spinlock_release(&rwtest_lock);
+
+			if (testval1 != testval2) {
+				rwfail(num, "reader saw a write in progress");
+			}
+			for (j=0; j<100; j++);
+
+			spinlock_acquire(&rwtest_lock);
+			rwtest_readers--;
+			spinlock_release(&rwtest_lock);
+		}
+		rw_exit(write);
+
+		if (rwtest_mode == RWMODE_SLEEP && i % 16 == 0) {
+			/* give others a chance to pile up behind us */
+			thread_yield();
+		}
+	}
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+static
+void
+rwtest_init(void)
+{
+	inititems();
+	if (testrw == NULL) {
+		testrw = rwlock_create("testrw");
+		if (testrw == NULL) {
+			panic("synchtest: rwlock_create failed\n");
+		}
+	}
+}
+
+static
+void
+rwtest_clean(void)
+{
+	rwlock_destroy(testrw);
+	testrw = NULL;
+#ifdef UW
+  cleanitems();
+#endif
+}
+
+int
+rwtest(int nargs, char **args)
+{
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	rwtest_init();
+	kprintf("Starting RW lock test...\n");
+
+	rwtest_failures = 0;
+	for (rwtest_mode = RWMODE_SLEEP; rwtest_mode <= RWMODE_SPIN;
+	     rwtest_mode++) {
+		testval1 = testval2 = 0;
+		for (i=0; i<NTHREADS; i++) {
+			result = thread_fork("rwtest", NULL, rwtestthread,
+					     NULL, i);
+			if (result) {
+				panic("rwtest: thread_fork failed: %s\n",
+				      strerror(result));
+			}
+		}
+		for (i=0; i<NTHREADS; i++) {
+			P(donesem);
+		}
+	}
+
+	rwtest_clean();
+	if (rwtest_failures > 0) {
+		kprintf("RW lock test failed\n");
+	}
+	else {
+		kprintf("RW lock test done\n");
+	}
+
+	return 0;
+}
+
+static
+void
+rwbenchthread(void *junk, unsigned long num)
+{
+	volatile int j;
+	int i;
+	bool write;
+
+	(void)junk;
+
+	for (i=0; i<RWBENCHOPS; i++) {
+		write = ((i + num) % RWBENCHWRITE == 0);
+		rw_enter(write);
+		if (write) {
+			testval1++;
+		}
+		for (j=0; j<200; j++);
+		rw_exit(write);
+	}
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+int
+rwbench(int nargs, char **args)
+{
+	static const char *const names[] = { "lock", "rwlock", "rwspinlock" };
+	uint64_t start, ns;
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	rwtest_init();
+	kprintf("Starting RW lock throughput test...\n");
+
+	for (rwtest_mode = RWMODE_LOCK; rwtest_mode <= RWMODE_SPIN;
+	     rwtest_mode++) {
+		start = clock_nsecs();
+		for (i=0; i<RWBENCHTHREADS; i++) {
+			result = thread_fork("rwbench", NULL, rwbenchthread,
+					     NULL, i);
+			if (result) {
+				panic("rwbench: thread_fork failed: %s\n",
+				      strerror(result));
+			}
+		}
+		for (i=0; i<RWBENCHTHREADS; i++) {
+			P(donesem);
+		}
+		ns = clock_nsecs() - start;
+		kprintf("%-10s %8u ops in %u ms, %u ops/ms\n",
+			names[rwtest_mode], RWBENCHTHREADS * RWBENCHOPS,
+			(unsigned)(ns / 1000000),
+			(unsigned)((uint64_t)RWBENCHTHREADS * RWBENCHOPS *
+				   1000000 / (ns ? ns : 1)));
+	}
+
+	rwtest_clean();
+	kprintf("RW lock throughput test done\n");
+
+	return 0;
+}
+
+/*
+ * Fair semaphore latency test. Like lhd_io with lh_clear, each thread
+ * takes a mutex semaphore, holds it for a little while, gives it up
+ * and asks for it again straight away. This runs with a plain
+ * semaphore and then with a fair one, and reports the longest and
+ * the average time a thread spent in P.
+ *
+ * With a plain semaphore the thread that just did V usually gets the
+ * count right back, so waiters can wait for many holds in a row. With
+ * a fair one a thread in P is behind at most the other FAIRTHREADS-1
+ * threads, so its wait is bounded by FAIRTHREADS times the longest
+ * time from one thread getting the semaphore to the next one getting
+ * it. That bound is checked.
+ */
+#define FAIRTHREADS	8
+#define FAIRLOOPS	100
+
+static struct semaphore *fairsem;
+static volatile uint64_t fair_maxwait;	/* these under fairsem */
+static volatile uint64_t fair_totalwait;
+static volatile uint64_t fair_maxgap;
+static volatile uint64_t fair_lastgrant;
+
+static
+void
+semfairthread(void *junk, unsigned long num)
+{
+	uint64_t start, now;
+	volatile int j;
+	int i;
+
+	(void)junk;
+	(void)num;
+
+	for (i=0; i<FAIRLOOPS; i++) {
+		start = clock_nsecs();
+		P(fairsem);
+		now = clock_nsecs();
+		if (now - start > fair_maxwait) {
+			fair_maxwait = now - start;
+		}
+		fair_totalwait += now - start;
+		if (fair_lastgrant != 0 && now - fair_lastgrant > fair_maxgap) {
+			fair_maxgap = now - fair_lastgrant;
+		}
+		fair_lastgrant = now;
+		for (j=0; j<2000; j++);
+		V(fairsem);
+	}
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+int
+semfairtest(int nargs, char **args)
+{
+	static const char *const names[] = { "plain", "fair" };
+	unsigned fair;
+	bool failed = false;
+	int i, result;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	kprintf("Starting fair semaphore latency test...\n");
+
+	for (fair = 0; fair <= 1; fair++) {
+		fairsem = fair ? sem_create_fair("fairsem", 1) :
+			sem_create("fairsem", 1);
+		if (fairsem == NULL) {
+			panic("semfairtest: sem_create failed\n");
+		}
+		fair_maxwait = fair_totalwait = 0;
+		fair_maxgap = fair_lastgrant = 0;
+
+		for (i=0; i<FAIRTHREADS; i++) {
+			result = thread_fork("semfairtest", NULL,
+					     semfairthread, NULL, i);
+			if (result) {
+				panic("semfairtest: thread_fork failed: %s\n",
+				      strerror(result));
+			}
+		}
+		for (i=0; i<FAIRTHREADS; i++) {
+			P(donesem);
+		}
+
+		kprintf("%-6s wait: worst %u us, average %u us; "
+			"longest between grants %u us\n", names[fair],
+			(unsigned)(fair_maxwait / 1000),
+			(unsigned)(fair_totalwait /
+				   (FAIRTHREADS * FAIRLOOPS) / 1000),
+			(unsigned)(fair_maxgap / 1000));
+		if (fair && fair_maxwait > FAIRTHREADS * fair_maxgap) {
+			kprintf("fair semaphore: worst wait over the bound "
+				"of %u us\n",
+				(unsigned)(FAIRTHREADS * fair_maxgap / 1000));
+			failed = true;
+		}
+		sem_destroy(fairsem);
+		fairsem = NULL;
+	}
+
+#ifdef UW
+  cleanitems();
+#endif
+	if (failed) {
+		kprintf("Fair semaphore latency test failed\n");
+	}
+	else {
+		kprintf("Fair semaphore latency test done\n");
+	}
+
+	return 0;
+}
+
+/*
+ * Priority inheritance test. CPU hogs at nice 10, one per cpu, keep
+ * every cpu busy for PIHOGNS. A thread at nice 19 takes a mutex and,
+ * holding it, sleeps until a thread at the top level has been started
+ * to want the mutex; then it needs PIHOLDNS of cpu time to finish.
+ * Reported is how long that thread was blocked.
+ *
+ * With a semaphore as the mutex nothing is inherited: the holder only
+ * gets a cpu when the hogs have sunk to its level between priority
+ * boosts (see schedule), so the waiter is blocked for a good part of
+ * PIHOGNS. With a lock the holder runs at the waiter's level, so
+ * the waiter is blocked for about PIHOLDNS; that bound, plus some
+ * slack for scheduling, is checked.
+ */
+#define PIHOGNS		1000000000ULL	/* 1 s */
+#define PIHOLDNS	50000000ULL	/* 50 ms */
+#define PISLACKNS	50000000ULL
+
+static struct semaphore *pisem;
+static struct semaphore *pistarted;
+static struct semaphore *pigo;
+static bool pi_uselock;
+static unsigned pi_holdloops;		/* PIHOLDNS worth of work */
+static volatile uint64_t pi_blocked;
+
+static
+void
+pi_work(unsigned loops)
+{
+	volatile unsigned j;
+
+	for (j=0; j<loops; j++);
+}
+
+static
+void
+pi_enter(void)
+{
+	if (pi_uselock) {
+		lock_acquire(testlock);
+	}
+	else {
+		P(pisem);
+	}
+}
+
+static
+void
+pi_exit(void)
+{
+	if (pi_uselock) {
+		lock_release(testlock);
+	}
+	else {
+		V(pisem);
+	}
+}
+
+static
+void
+pihogthread(void *junk, unsigned long num)
+{
+	uint64_t end;
+
+	(void)junk;
+	(void)num;
+
+	/* as setpriority does; this puts us straight down at the floor */
+	thread_setnice(curthread, 10);
+
+	end = clock_nsecs() + PIHOGNS;
+	while (clock_nsecs() < end) {
+		pi_work(1000);
+	}
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+static
+void
+pilowthread(void *junk, unsigned long num)
+{
+	(void)junk;
+	(void)num;
+
+	pi_enter();
+	thread_setnice(curthread, 19);
+	V(pistarted);
+	/* wake up at the bottom level, behind the hogs */
+	P(pigo);
+	pi_work(pi_holdloops);
+	pi_exit();
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+static
+void
+pihighthread(void *junk, unsigned long num)
+{
+	uint64_t start;
+
+	(void)junk;
+	(void)num;
+
+	start = clock_nsecs();
+	pi_enter();
+	pi_blocked = clock_nsecs() - start;
+	pi_exit();
+	V(donesem);
+#ifdef UW
+  thread_exit();
+#endif
+}
+
+static
+void
+pitest_fork(const char *name, void (*func)(void *, unsigned long))
+{
+	int result;
+
+	result = thread_fork(name, NULL, func, NULL, 0);
+	if (result) {
+		panic("pitest: thread_fork failed: %s\n", strerror(result));
+	}
+}
+
+int
+pitest(int nargs, char **args)
+{
+	uint64_t start;
+	unsigned mode, i, ncpus;
+	bool failed = false;
+
+	(void)nargs;
+	(void)args;
+
+	inititems();
+	pisem = sem_create("pisem", 1);
+	pistarted = sem_create("pistarted", 0);
+	pigo = sem_create("pigo", 0);
+	if (pisem == NULL || pistarted == NULL || pigo == NULL) {
+		panic("pitest: sem_create failed\n");
+	}
+	for (ncpus=0; cpu_get(ncpus) != NULL; ncpus++) {
+		/* nothing */
+	}
+	kprintf("Starting priority inheritance test...\n");
+
+	/* how much work is PIHOLDNS of cpu time */
+	pi_holdloops = 0;
+	start = clock_nsecs();
+	while (clock_nsecs() - start < PIHOLDNS) {
+		pi_work(1000);
+		pi_holdloops += 1000;
+	}
+
+	for (mode=0; mode<=1; mode++) {
+		pi_uselock = (mode == 1);
+		pi_blocked = 0;
+
+		for (i=0; i<ncpus; i++) {
+			pitest_fork("pihog", pihogthread);
+		}
+		pitest_fork("pilow", pilowthread);
+		P(pistarted);
+		pitest_fork("pihigh", pihighthread);
+		V(pigo);
+		for (i=0; i<ncpus + 2; i++) {
+			P(donesem);
+		}
+
+		kprintf("%-9s high-priority thread blocked for %u ms\n",
+			pi_uselock ? "lock" : "semaphore",
+			(unsigned)(pi_blocked / 1000000));
+		if (pi_uselock && pi_blocked > PIHOLDNS + PISLACKNS) {
+			kprintf("lock: blocked for over the bound of %u ms\n",
+				(unsigned)((PIHOLDNS + PISLACKNS) / 1000000));
+			failed = true;
+		}
+	}
+
+	sem_destroy(pigo);
+	sem_destroy(pistarted);
+	sem_destroy(pisem);
+	pigo = pistarted = pisem = NULL;
+#ifdef UW
+  cleanitems();
+#endif
+	if (failed) {
+		kprintf("Priority inheritance test failed\n");
+	}
+	else {
+		kprintf("Priority inheritance test done\n");
+	}
+
+	return 0;
+}
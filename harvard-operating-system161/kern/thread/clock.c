@@ -28,9 +28,12 @@
  */
 
 #include <types.h>
+#include <kern/errno.h>
 #include <lib.h>
 #include <cpu.h>
+#include <spinlock.h>
 #include <wchan.h>
+#include <kern/time.h>
 #include <clock.h>
 #include <thread.h>
 #include <lamebus/ltimer.h>
@@ -39,9 +42,9 @@
 /*
  * Time handling.
  *
- * This is pretty primitive. A real kernel will typically have some
- * kind of support for scheduling callbacks to happen at specific
- * points in the future, usually with more resolution that one second.
+ * This is still fairly primitive. A real kernel will typically have
+ * some kind of support for scheduling callbacks to happen at specific
+ * points in the future; we only have timed sleeps, below.
  *
  * A real kernel also has to maintain the time of day; in OS/161 we
  * skimp on that because we have a known-good hardware clock.
@@ -51,27 +54,41 @@
  * Timing constants. These should be tuned along with any work done on
  * the scheduler.
  */
-#define SCHEDULE_HARDCLOCKS	4	/* Reschedule every 4 hardclocks. */
+#define SCHEDULE_HARDCLOCKS	HZ	/* Priority boost once a second. */
 #define MIGRATE_HARDCLOCKS	16	/* Migrate every 16 hardclocks. */
 
 /*
- * Once a second, everything waiting on lbolt is awakened by CPU 0.
- */
-static struct wchan *lbolt;
-/*
- * Once every LT_GRANULARITY usec, everything on minibolt is awakenened by CPU 0
+ * Timed sleeps.
+ *
+ * A thread in clock_sleepticks waits on its own wait channel
+ * (t_timerchan) and is filed by deadline in a hierarchical timer
+ * wheel. Level 0 has one slot per timerclock tick for the next
+ * TW_SLOTS ticks; each level after that has slots TW_SLOTS times as
+ * wide. Every TW_SLOTS ticks, the level 1 slot coming up is emptied
+ * into level 0 ("cascading"), and so on up. So a tick costs the
+ * sleepers whose time is up and, now and then, one slot's worth of
+ * refiling, and not one thing per sleeping thread.
+ *
+ * Deadlines are in timerclock ticks of LT_GRANULARITY usec, counted
+ * by tw_now; they wrap, so compare them by difference. Sleeps longer
+ * than the wheel covers go in its last slot and are refiled when they
+ * come out.
+ *
+ * Everything here, including the t_timer* fields of sleeping threads,
+ * is under tw_lock. Lock order: p_lock, tw_lock, wchan lock.
  */
-static struct wchan *minibolt;
+#define TW_BITS		6
+#define TW_SLOTS	(1U << TW_BITS)
+#define TW_MASK		(TW_SLOTS - 1)
+#define TW_LEVELS	4
+#define TW_MAXDELTA	((1U << (TW_BITS * TW_LEVELS)) - 1)
 
-/* 
- * number of minibolts per second
- */
-#define MINI_PER_SECOND (1000000/LT_GRANULARITY);
+/* timerclock ticks per second */
+#define TW_HZ		(1000000 / LT_GRANULARITY)
 
-/*
- * minibolt countdown
- */
-static int minicount;
+static struct spinlock tw_lock = SPINLOCK_INITIALIZER;
+static struct thread *tw_wheel[TW_LEVELS][TW_SLOTS];
+static uint32_t tw_now;
 
 /*
  * Setup.
@@ -79,17 +96,69 @@ static int minicount;
 void
 hardclock_bootstrap(void)
 {
-	lbolt = wchan_create("lbolt");
-	if (lbolt == NULL) {
-		panic("Couldn't create lbolt\n");
+	/* we assume TW_HZ > 0 */
+	KASSERT(TW_HZ > 0);
+}
+
+/*
+ * File T in the slot for its deadline.
+ */
+static
+void
+tw_insert(struct thread *t)
+{
+	uint32_t delta, expires;
+	unsigned level;
+	struct thread **slot;
+
+	KASSERT(spinlock_do_i_hold(&tw_lock));
+
+	delta = t->t_wakeup - tw_now;
+	expires = t->t_wakeup;
+	if (delta > TW_MAXDELTA) {
+		/* too far off; refiled when it comes out */
+		delta = TW_MAXDELTA;
+		expires = tw_now + delta;
+	}
+	for (level = 0; level < TW_LEVELS - 1; level++) {
+		if (delta < (1U << (TW_BITS * (level + 1)))) {
+			break;
+		}
 	}
-	minibolt = wchan_create("minibolt");
-	if (minibolt == NULL) {
-		panic("Couldn't create minibolt\n");
+	slot = &tw_wheel[level][(expires >> (TW_BITS * level)) & TW_MASK];
+
+	t->t_timernext = *slot;
+	if (*slot != NULL) {
+		(*slot)->t_timerprev = &t->t_timernext;
 	}
-	minicount = MINI_PER_SECOND;
-	/* we assume MINI_PER_SECOND > 0 */
-	KASSERT(minicount > 0);
+	t->t_timerprev = slot;
+	*slot = t;
+}
+
+static
+void
+tw_remove(struct thread *t)
+{
+	KASSERT(spinlock_do_i_hold(&tw_lock));
+	KASSERT(t->t_timerprev != NULL);
+
+	*t->t_timerprev = t->t_timernext;
+	if (t->t_timernext != NULL) {
+		t->t_timernext->t_timerprev = t->t_timerprev;
+	}
+	t->t_timernext = NULL;
+	t->t_timerprev = NULL;
+}
+
+/*
+ * Take a thread off the wheel and wake it up.
+ */
+static
+void
+tw_wake(struct thread *t)
+{
+	tw_remove(t);
+	wchan_wakeone(t->t_timerchan);
 }
 
 /*
@@ -99,18 +168,44 @@ hardclock_bootstrap(void)
 void
 timerclock(void)
 {
-	/* Broadcast on minibolt */
-	wchan_wakeall(minibolt);
-	/* Broadcast on lbolt if a second has elapsed */
-	if (--minicount <= 0) {
-	  minicount = MINI_PER_SECOND;
-	  wchan_wakeall(lbolt);
+	struct thread *t, *list;
+	unsigned level;
+
+	spinlock_acquire(&tw_lock);
+	tw_now++;
+
+	/* Cascade: refile whatever is now within reach of a lower level. */
+	for (level = 1; level < TW_LEVELS; level++) {
+		if ((tw_now & ((1U << (TW_BITS * level)) - 1)) != 0) {
+			break;
+		}
+		list = tw_wheel[level][(tw_now >> (TW_BITS * level)) & TW_MASK];
+		while ((t = list) != NULL) {
+			list = t->t_timernext;
+			tw_remove(t);
+			tw_insert(t);
+		}
+	}
+
+	/* Wake the sleepers whose time is up. */
+	list = tw_wheel[0][tw_now & TW_MASK];
+	while ((t = list) != NULL) {
+		list = t->t_timernext;
+		if ((int32_t)(t->t_wakeup - tw_now) > 0) {
+			/* a long sleep that was parked in the last slot */
+			tw_remove(t);
+			tw_insert(t);
+		}
+		else {
+			tw_wake(t);
+		}
 	}
+	spinlock_release(&tw_lock);
 }
 
 /*
  * This is called HZ times a second (on each processor) by the timer
- * code.
+ * code. An idle processor stops its timer; see thread_switch.
  */
 void
 hardclock(void)
@@ -120,13 +215,113 @@ hardclock(void)
 	 */
 
 	curcpu->c_hardclocks++;
+	if (curcpu->c_isidle) {
+		/* Idle time isn't charged to the idle cpu's curthread. */
+	}
+	else if (curcpu->c_userirq) {
+		curthread->t_usage.u_uticks++;
+	}
+	else {
+		curthread->t_usage.u_sticks++;
+	}
 	if ((curcpu->c_hardclocks % SCHEDULE_HARDCLOCKS) == 0) {
 		schedule();
 	}
 	if ((curcpu->c_hardclocks % MIGRATE_HARDCLOCKS) == 0) {
 		thread_consider_migration();
 	}
-	thread_yield();
+	thread_tick();
+}
+
+/*
+ * Sleep for TICKS timerclock ticks. The current tick is already partly
+ * over, so this waits one extra to make sure at least the requested
+ * time goes by.
+ */
+int
+clock_sleepticks(uint32_t ticks)
+{
+	struct thread *cur = curthread;
+	struct wchan *wc;
+	int result;
+
+	if (cur->t_timerchan == NULL) {
+		/* kept for the life of the thread, like its stack */
+		wc = wchan_create("timer");
+		if (wc == NULL) {
+			return ENOMEM;
+		}
+		cur->t_timerchan = wc;
+	}
+	if (ticks == 0) {
+		return 0;
+	}
+
+	spinlock_acquire(&tw_lock);
+	if (cur->t_timerintr) {
+		spinlock_release(&tw_lock);
+		return EINTR;
+	}
+	cur->t_wakeup = tw_now + ticks + 1;
+	tw_insert(cur);
+	wchan_lock(cur->t_timerchan);
+	spinlock_release(&tw_lock);
+	wchan_sleep(cur->t_timerchan);
+
+	spinlock_acquire(&tw_lock);
+	KASSERT(cur->t_timerprev == NULL);
+	result = cur->t_timerintr ? EINTR : 0;
+	spinlock_release(&tw_lock);
+	return result;
+}
+
+/*
+ * Cut short T's timed sleep, if it is in one, and any it tries later.
+ */
+void
+clock_interrupt(struct thread *t)
+{
+	spinlock_acquire(&tw_lock);
+	t->t_timerintr = true;
+	if (t->t_timerprev != NULL) {
+		tw_wake(t);
+	}
+	spinlock_release(&tw_lock);
+}
+
+/*
+ * Sleep for the time in TS, rounded up to whole ticks. If cut short,
+ * return EINTR with the time that was left in TS.
+ */
+int
+clock_sleep(struct timespec *ts)
+{
+	uint64_t ticks;
+	uint32_t left;
+	int result;
+
+	KASSERT(ts->tv_sec >= 0);
+	KASSERT(ts->tv_nsec >= 0 && ts->tv_nsec < 1000000000);
+
+	ticks = (uint64_t)ts->tv_sec * TW_HZ;
+	ticks += DIVROUNDUP((uint32_t)ts->tv_nsec, LT_GRANULARITY * 1000);
+	if (ticks > 0x7ffffffe) {
+		/* keep deadlines comparable; this is over 200 days */
+		ticks = 0x7ffffffe;
+	}
+
+	result = clock_sleepticks(ticks);
+	if (result == EINTR) {
+		spinlock_acquire(&tw_lock);
+		left = curthread->t_wakeup - tw_now;
+		spinlock_release(&tw_lock);
+		if ((int32_t)left < 0) {
+			left = 0;
+		}
+		ts->tv_sec = left / TW_HZ;
+		ts->tv_nsec = (left % TW_HZ) * LT_GRANULARITY * 1000;
+	}
+	return result;
 }
 
 /*
@@ -135,11 +330,9 @@ hardclock(void)
 void
 clocksleep(int num_secs)
 {
-  while (num_secs > 0) {
-    wchan_lock(lbolt);
-    wchan_sleep(lbolt);
-    num_secs--;
-  }
+	if (num_secs > 0) {
+		clock_sleepticks((uint32_t)num_secs * TW_HZ);
+	}
 }
 
 /*
@@ -149,9 +342,7 @@ clocksleep(int num_secs)
 void
 clocknap(int num_ticks)
 {
-  while (num_ticks > 0) {
-    wchan_lock(minibolt);
-    wchan_sleep(minibolt);
-    num_ticks--;
-  }
+	if (num_ticks > 0) {
+		clock_sleepticks(num_ticks);
+	}
 }
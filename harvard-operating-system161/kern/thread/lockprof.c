@@ -0,0 +1,285 @@
+/*
+ * Lock contention profiling. See <lockprof.h>.
+ */
+
+#include <types.h>
+#include <lib.h>
+#include <clock.h>
+#include <spl.h>
+#include <spinlock.h>
+#include <lockprof.h>
+
+/* Entries, at most; locks beyond that are lumped together. */
+#define LOCKPROF_MAX		512
+#define LOCKPROF_NAMELEN	24
+#define LOCKPROF_HASHSIZE	64	/* must be a power of two */
+
+/*
+ * One lock name or spinlock call site. Entries are never freed, and
+ * a chain only ever grows at the head, after the new entry is filled
+ * in; so lookups can walk the chains without a lock.
+ *
+ * This code cannot use spinlocks, since it is called from inside
+ * spinlock_acquire, so lp_lock and lockprof_tablelock are bare lock
+ * words, taken with interrupts off.
+ */
+struct lockprof {
+	unsigned lp_kind;
+	char lp_name[LOCKPROF_NAMELEN];
+	const void *lp_site;
+	volatile spinlock_data_t lp_lock;	/* for the counts */
+	unsigned lp_nacquire;
+	unsigned lp_ncontended;
+	uint64_t lp_waitns;
+	uint64_t lp_maxwaitns;
+	uint64_t lp_maxholdns;
+	struct lockprof *volatile lp_next;	/* hash chain */
+};
+
+static struct lockprof lockprof_pool[LOCKPROF_MAX];
+static unsigned lockprof_nused;
+static struct lockprof lockprof_other = { .lp_name = "(others)" };
+static struct lockprof *volatile lockprof_hash[LOCKPROF_HASHSIZE];
+static volatile spinlock_data_t lockprof_tablelock;
+
+static
+void
+rawlock(volatile spinlock_data_t *sd)
+{
+	while (spinlock_data_get(sd) != 0 ||
+	       spinlock_data_testandset(sd) != 0) {
+		/* spin */
+	}
+}
+
+static
+void
+rawunlock(volatile spinlock_data_t *sd)
+{
+	spinlock_data_set(sd, 0);
+}
+
+static
+unsigned
+lockprof_hashof(const char *name, const void *site)
+{
+	unsigned h = 0;
+
+	if (name == NULL) {
+		return ((uintptr_t)site >> 2) & (LOCKPROF_HASHSIZE - 1);
+	}
+	while (*name) {
+		h = h * 31 + (unsigned char)*name++;
+	}
+	return h & (LOCKPROF_HASHSIZE - 1);
+}
+
+/* Compare NAME with an entry's name, which may have been truncated. */
+static
+bool
+lockprof_namematch(const char *lpname, const char *name)
+{
+	unsigned i;
+
+	for (i=0; i<LOCKPROF_NAMELEN - 1; i++) {
+		if (lpname[i] != name[i]) {
+			return false;
+		}
+		if (name[i] == 0) {
+			return true;
+		}
+	}
+	return true;
+}
+
+static
+struct lockprof *
+lockprof_find(unsigned h, unsigned kind, const char *name, const void *site)
+{
+	struct lockprof *lp;
+
+	for (lp = lockprof_hash[h]; lp != NULL; lp = lp->lp_next) {
+		if (lp->lp_kind != kind) {
+			continue;
+		}
+		if (name == NULL ? lp->lp_site == site :
+		    lockprof_namematch(lp->lp_name, name)) {
+			return lp;
+		}
+	}
+	return NULL;
+}
+
+struct lockprof *
+lockprof_get(unsigned kind, const char *name, const void *site)
+{
+	struct lockprof *lp;
+	unsigned h, i;
+	int spl;
+
+	h = lockprof_hashof(name, site);
+	lp = lockprof_find(h, kind, name, site);
+	if (lp != NULL) {
+		return lp;
+	}
+
+	spl = splhigh();
+	rawlock(&lockprof_tablelock);
+	/* somebody may have added it meanwhile */
+	lp = lockprof_find(h, kind, name, site);
+	if (lp == NULL && lockprof_nused == LOCKPROF_MAX) {
+		lp = &lockprof_other;
+	}
+	else if (lp == NULL) {
+		lp = &lockprof_pool[lockprof_nused++];
+		lp->lp_kind = kind;
+		for (i=0; name != NULL && name[i] && i < LOCKPROF_NAMELEN - 1;
+		     i++) {
+			lp->lp_name[i] = name[i];
+		}
+		lp->lp_site = site;
+		lp->lp_next = lockprof_hash[h];
+		lockprof_hash[h] = lp;
+	}
+	rawunlock(&lockprof_tablelock);
+	splx(spl);
+	return lp;
+}
+
+uint64_t
+lockprof_now(void)
+{
+	return clock_nsecs();
+}
+
+uint64_t
+lockprof_acquired(struct lockprof *lp, bool contended, uint64_t waitstart)
+{
+	uint64_t now, wait;
+	int spl;
+
+	now = lockprof_now();
+	wait = contended ? now - waitstart : 0;
+
+	spl = splhigh();
+	rawlock(&lp->lp_lock);
+	lp->lp_nacquire++;
+	if (contended) {
+		lp->lp_ncontended++;
+		lp->lp_waitns += wait;
+		if (wait > lp->lp_maxwaitns) {
+			lp->lp_maxwaitns = wait;
+		}
+	}
+	rawunlock(&lp->lp_lock);
+	splx(spl);
+	return now;
+}
+
+void
+lockprof_released(struct lockprof *lp, uint64_t acqat)
+{
+	uint64_t hold;
+	int spl;
+
+	hold = lockprof_now() - acqat;
+
+	spl = splhigh();
+	rawlock(&lp->lp_lock);
+	if (hold > lp->lp_maxholdns) {
+		lp->lp_maxholdns = hold;
+	}
+	rawunlock(&lp->lp_lock);
+	splx(spl);
+}
+
+static
+void
+lockprof_printus(uint64_t ns)
+{
+	kprintf(" %9llu", (unsigned long long)(ns / 1000));
+}
+
+/*
+ * Print the N entries with the most contended acquisitions. The
+ * counts are read without locking; they are only statistics.
+ */
+void
+lockprof_print(unsigned n)
+{
+	struct lockprof *lp, *best;
+	bool shown[LOCKPROF_MAX + 1];
+	unsigned i, j, nused;
+	const char *kind;
+	char name[LOCKPROF_NAMELEN];
+
+	nused = lockprof_nused;
+	bzero(shown, sizeof(shown));
+
+	kprintf("lock                     kind  acquired contended"
+		"  avg wait  max wait  max hold (us)\n");
+	for (i=0; i<n; i++) {
+		best = NULL;
+		for (j=0; j<=nused; j++) {
+			lp = (j < nused) ? &lockprof_pool[j] : &lockprof_other;
+			if (shown[j] || lp->lp_ncontended == 0) {
+				continue;
+			}
+			if (best == NULL ||
+			    lp->lp_ncontended > best->lp_ncontended) {
+				best = lp;
+			}
+		}
+		if (best == NULL) {
+			break;
+		}
+		shown[best == &lockprof_other ? nused :
+		      (unsigned)(best - lockprof_pool)] = true;
+
+		kind = best == &lockprof_other ? "-" :
+			best->lp_kind == LOCKPROF_LOCK ? "lock" :
+			best->lp_kind == LOCKPROF_SEM ? "sem" : "spin";
+		if (best->lp_kind == LOCKPROF_SPIN && best != &lockprof_other) {
+			snprintf(name, sizeof(name), "at %p", best->lp_site);
+		}
+		else {
+			strcpy(name, best->lp_name);
+		}
+		kprintf("%-24s %-4s %9u %9u", name, kind, best->lp_nacquire,
+			best->lp_ncontended);
+		lockprof_printus(best->lp_waitns / best->lp_ncontended);
+		lockprof_printus(best->lp_maxwaitns);
+		if (best->lp_kind == LOCKPROF_SEM) {
+			kprintf("         -\n");
+		}
+		else {
+			lockprof_printus(best->lp_maxholdns);
+			kprintf("\n");
+		}
+	}
+	if (i == 0) {
+		kprintf("(no contention)\n");
+	}
+}
+
+void
+lockprof_reset(void)
+{
+	struct lockprof *lp;
+	unsigned i, nused;
+	int spl;
+
+	nused = lockprof_nused;
+	for (i=0; i<=nused; i++) {
+		lp = (i < nused) ? &lockprof_pool[i] : &lockprof_other;
+		spl = splhigh();
+		rawlock(&lp->lp_lock);
+		lp->lp_nacquire = 0;
+		lp->lp_ncontended = 0;
+		lp->lp_waitns = 0;
+		lp->lp_maxwaitns = 0;
+		lp->lp_maxholdns = 0;
+		rawunlock(&lp->lp_lock);
+		splx(spl);
+	}
+}
@@ -0,0 +1,203 @@
+/*
+ * Scheduler event tracing. See <schedtrace.h>.
+ */
+
+#include <types.h>
+#include <kern/errno.h>
+#include <kern/fcntl.h>
+#include <lib.h>
+#include <clock.h>
+#include <cpu.h>
+#include <spl.h>
+#include <thread.h>
+#include <current.h>
+#include <uio.h>
+#include <vfs.h>
+#include <vnode.h>
+#include <schedtrace.h>
+
+/* Events kept per cpu. Must be a power of two. */
+#define SCHEDTRACE_RINGSIZE	2048
+
+/*
+ * An event as logged. Names are copied in right away: by the time of
+ * the dump, the threads and wchans of exited processes have been freed
+ * or recycled.
+ */
+struct schedtrace_event {
+	uint32_t se_sec;
+	uint32_t se_nsec;
+	unsigned se_type;
+	unsigned se_arg;
+	struct thread *se_thread;
+	char se_thname[SCHEDTRACE_NAMELEN];
+	char se_wcname[SCHEDTRACE_NAMELEN];
+};
+
+struct schedtrace_ring {
+	unsigned r_next;		/* events logged since the start */
+	struct schedtrace_event r_events[SCHEDTRACE_RINGSIZE];
+};
+
+volatile bool schedtrace_running;
+
+static
+void
+copyname(char *to, const char *from)
+{
+	unsigned i;
+
+	for (i=0; from != NULL && i < SCHEDTRACE_NAMELEN - 1 && from[i]; i++) {
+		to[i] = from[i];
+	}
+	for (; i < SCHEDTRACE_NAMELEN; i++) {
+		to[i] = 0;
+	}
+}
+
+/*
+ * Log an event to the current cpu's ring. Callers mostly hold a run
+ * queue lock, so interrupts are off already; if not, turn them off so
+ * nothing else on this cpu logs in the middle.
+ */
+void
+schedtrace_log(unsigned type, struct thread *t, const char *wcname,
+	       unsigned arg)
+{
+	struct schedtrace_ring *r;
+	struct schedtrace_event *se;
+	time_t sec;
+	uint32_t nsec;
+	int spl;
+
+	r = curcpu->c_trace;
+	if (r == NULL) {
+		return;
+	}
+
+	spl = splhigh();
+	gettime(&sec, &nsec);
+	se = &r->r_events[r->r_next & (SCHEDTRACE_RINGSIZE - 1)];
+	r->r_next++;
+	se->se_sec = sec;
+	se->se_nsec = nsec;
+	se->se_type = type;
+	se->se_arg = arg;
+	se->se_thread = t;
+	copyname(se->se_thname, t->t_name);
+	copyname(se->se_wcname, wcname);
+	splx(spl);
+}
+
+int
+schedtrace_start(void)
+{
+	struct cpu *c;
+	unsigned i;
+
+	schedtrace_running = false;
+	for (i=0; (c = cpu_get(i)) != NULL; i++) {
+		if (c->c_trace == NULL) {
+			c->c_trace = kmalloc(sizeof(*c->c_trace));
+			if (c->c_trace == NULL) {
+				return ENOMEM;
+			}
+		}
+		c->c_trace->r_next = 0;
+	}
+	schedtrace_running = true;
+	return 0;
+}
+
+void
+schedtrace_stop(void)
+{
+	schedtrace_running = false;
+}
+
+static
+int
+dumpwrite(struct vnode *vn, off_t *pos, void *data, size_t len)
+{
+	struct iovec iov;
+	struct uio ku;
+	int result;
+
+	uio_kinit(&iov, &ku, data, len, *pos, UIO_WRITE);
+	result = VOP_WRITE(vn, &ku);
+	if (result) {
+		return result;
+	}
+	if (ku.uio_resid > 0) {
+		return ENOSPC;
+	}
+	*pos = ku.uio_offset;
+	return 0;
+}
+
+int
+schedtrace_dump(char *path)
+{
+	struct schedtrace_header sh;
+	struct schedtrace_cpu sc;
+	struct schedtrace_record sr;
+	struct schedtrace_ring *r;
+	struct schedtrace_event *se;
+	struct vnode *vn;
+	struct cpu *c;
+	unsigned i, n, first;
+	off_t pos;
+	int result;
+
+	if (schedtrace_running) {
+		return EBUSY;
+	}
+
+	result = vfs_open(path, O_WRONLY|O_CREAT|O_TRUNC, 0664, &vn);
+	if (result) {
+		return result;
+	}
+
+	pos = 0;
+	sh.sh_magic = SCHEDTRACE_MAGIC;
+	for (sh.sh_ncpus = 0; cpu_get(sh.sh_ncpus) != NULL; sh.sh_ncpus++) {
+		/* nothing */
+	}
+	result = dumpwrite(vn, &pos, &sh, sizeof(sh));
+
+	for (i=0; result == 0 && i < sh.sh_ncpus; i++) {
+		c = cpu_get(i);
+		r = c->c_trace;
+		sc.sc_cpu = c->c_number;
+		sc.sc_nrecords = 0;
+		sc.sc_lost = 0;
+		first = 0;
+		if (r != NULL) {
+			sc.sc_nrecords = r->r_next;
+			if (r->r_next > SCHEDTRACE_RINGSIZE) {
+				sc.sc_nrecords = SCHEDTRACE_RINGSIZE;
+				sc.sc_lost = r->r_next - SCHEDTRACE_RINGSIZE;
+				first = sc.sc_lost;
+			}
+		}
+		result = dumpwrite(vn, &pos, &sc, sizeof(sc));
+
+		for (n=0; result == 0 && n < sc.sc_nrecords; n++) {
+			se = &r->r_events[(first + n) &
+					  (SCHEDTRACE_RINGSIZE - 1)];
+			sr.sr_sec = se->se_sec;
+			sr.sr_nsec = se->se_nsec;
+			sr.sr_type = se->se_type;
+			sr.sr_arg = se->se_arg;
+			sr.sr_thread = (uint32_t)se->se_thread;
+			memcpy(sr.sr_thname, se->se_thname,
+			       SCHEDTRACE_NAMELEN);
+			memcpy(sr.sr_wcname, se->se_wcname,
+			       SCHEDTRACE_NAMELEN);
+			result = dumpwrite(vn, &pos, &sr, sizeof(sr));
+		}
+	}
+
+	vfs_close(vn);
+	return result;
+}
@@ -38,9 +38,60 @@
 #include <current.h>	/* for curcpu */
 
 /*
- * Spinlocks.
+ * Spinlocks. See <spinlock.h> for the three ways of spinning.
  */
 
+#if OPT_MCSLOCK
+/*
+ * Queue nodes. Each cpu has a few in struct cpu, enough for all the
+ * spinlocks it can hold at once. Interrupts are off from before a
+ * node is taken until after it is given back, so nothing else on the
+ * cpu can get at the bitmap meanwhile. Before curcpu is set up there
+ * is only one cpu, and it uses mcs_bootnodes.
+ */
+static struct mcsnode mcs_bootnodes[SPINLOCK_MCSNODES];
+static unsigned mcs_bootused;
+
+static
+struct mcsnode *
+mcs_getnode(struct cpu *mycpu)
+{
+	struct mcsnode *pool;
+	unsigned *used;
+	unsigned i;
+
+	pool = mycpu ? mycpu->c_mcsnodes : mcs_bootnodes;
+	used = mycpu ? &mycpu->c_mcsused : &mcs_bootused;
+	for (i=0; i<SPINLOCK_MCSNODES; i++) {
+		if ((*used & (1U << i)) == 0) {
+			*used |= 1U << i;
+			return &pool[i];
+		}
+	}
+	panic("More than %d spinlocks held at once\n", SPINLOCK_MCSNODES);
+}
+
+static
+void
+mcs_putnode(struct mcsnode *node)
+{
+	struct mcsnode *pool;
+	unsigned *used;
+
+	if (node >= mcs_bootnodes &&
+	    node < mcs_bootnodes + SPINLOCK_MCSNODES) {
+		pool = mcs_bootnodes;
+		used = &mcs_bootused;
+	}
+	else {
+		KASSERT(CURCPU_EXISTS());
+		pool = curcpu->c_self->c_mcsnodes;
+		used = &curcpu->c_self->c_mcsused;
+		KASSERT(node >= pool && node < pool + SPINLOCK_MCSNODES);
+	}
+	*used &= ~(1U << (node - pool));
+}
+#endif
 
 /*
  * Initialize spinlock.
@@ -49,7 +100,17 @@ void
 spinlock_init(struct spinlock *lk)
 {
 	spinlock_data_set(&lk->lk_lock, 0);
+#if OPT_TICKETLOCK
+	spinlock_data_set(&lk->lk_serving, 0);
+#elif OPT_MCSLOCK
+	lk->lk_node = NULL;
+#endif
 	lk->lk_holder = NULL;
+#if OPT_LOCKPROF
+	lk->lk_nacquire = 0;
+	lk->lk_ncontended = 0;
+	lk->lk_maxspin = 0;
+#endif
 }
 
 /*
@@ -59,9 +120,29 @@ void
 spinlock_cleanup(struct spinlock *lk)
 {
 	KASSERT(lk->lk_holder == NULL);
+#if OPT_TICKETLOCK
+	KASSERT(spinlock_data_get(&lk->lk_lock) ==
+		spinlock_data_get(&lk->lk_serving));
+#else
 	KASSERT(spinlock_data_get(&lk->lk_lock) == 0);
+#endif
 }
 
+/*
+ * Note a turn of a spin loop in spinlock_acquire. When profiling,
+ * the first one is when the wait started; otherwise nothing is kept.
+ */
+#if OPT_LOCKPROF
+#define SPUN() \
+	do { \
+		if (spins++ == 0) { \
+			waitstart = lockprof_now(); \
+		} \
+	} while (0)
+#else
+#define SPUN() ((void)0)
+#endif
+
 /*
  * Get the lock.
  *
@@ -73,6 +154,15 @@ void
 spinlock_acquire(struct spinlock *lk)
 {
 	struct cpu *mycpu;
+#if OPT_LOCKPROF
+	unsigned spins = 0;
+	uint64_t waitstart = 0;
+#endif
+#if OPT_TICKETLOCK
+	spinlock_data_t ticket;
+#elif OPT_MCSLOCK
+	struct mcsnode *node, *pred;
+#endif
 
 	splraise(IPL_NONE, IPL_HIGH);
 
@@ -87,6 +177,31 @@ spinlock_acquire(struct spinlock *lk)
 		mycpu = NULL;
 	}
 
+#if OPT_TICKETLOCK
+	/* Take a ticket and wait for it to come up. */
+	ticket = spinlock_data_fetchadd(&lk->lk_lock, 1);
+	while (spinlock_data_get(&lk->lk_serving) != ticket) {
+		SPUN();
+	}
+#elif OPT_MCSLOCK
+	/*
+	 * Join the end of the queue. If there was somebody ahead of
+	 * us, link in behind them and wait for them to clear mn_wait
+	 * on the way out.
+	 */
+	node = mcs_getnode(mycpu);
+	node->mn_next = NULL;
+	node->mn_wait = true;
+	pred = (struct mcsnode *)
+		spinlock_data_swap(&lk->lk_lock, (spinlock_data_t)node);
+	if (pred != NULL) {
+		pred->mn_next = node;
+		while (node->mn_wait) {
+			SPUN();
+		}
+	}
+	lk->lk_node = node;
+#else
 	while (1) {
 		/*
 		 * Do test-test-and-set, that is, read first before
@@ -99,15 +214,31 @@ spinlock_acquire(struct spinlock *lk)
 		 * we don't.
 		 */
 		if (spinlock_data_get(&lk->lk_lock) != 0) {
+			SPUN();
 			continue;
 		}
 		if (spinlock_data_testandset(&lk->lk_lock) != 0) {
+			SPUN();
 			continue;
 		}
 		break;
 	}
+#endif
 
 	lk->lk_holder = mycpu;
+
+#if OPT_LOCKPROF
+	lk->lk_nacquire++;
+	if (spins > 0) {
+		lk->lk_ncontended++;
+		if (spins > lk->lk_maxspin) {
+			lk->lk_maxspin = spins;
+		}
+	}
+	lk->lk_prof = lockprof_get(LOCKPROF_SPIN, NULL,
+				   __builtin_return_address(0));
+	lk->lk_acqat = lockprof_acquired(lk->lk_prof, spins > 0, waitstart);
+#endif
 }
 
 /*
@@ -116,13 +247,46 @@ spinlock_acquire(struct spinlock *lk)
 void
 spinlock_release(struct spinlock *lk)
 {
+#if OPT_MCSLOCK
+	struct mcsnode *node, *next;
+#endif
+
 	/* this must work before curcpu initialization */
 	if (CURCPU_EXISTS()) {
 		KASSERT(lk->lk_holder == curcpu->c_self);
 	}
 
+#if OPT_LOCKPROF
+	lockprof_released(lk->lk_prof, lk->lk_acqat);
+#endif
+
 	lk->lk_holder = NULL;
+#if OPT_TICKETLOCK
+	/* only the holder writes lk_serving, so no atomic op needed */
+	spinlock_data_set(&lk->lk_serving,
+			  spinlock_data_get(&lk->lk_serving) + 1);
+#elif OPT_MCSLOCK
+	/*
+	 * Hand the lock to the next in line. If there seems to be
+	 * nobody, try to empty the queue; if that fails, somebody is
+	 * just joining and will link in behind us in a moment.
+	 */
+	node = lk->lk_node;
+	next = node->mn_next;
+	if (next == NULL &&
+	    spinlock_data_cas(&lk->lk_lock, (spinlock_data_t)node, 0)
+	    != (spinlock_data_t)node) {
+		while ((next = node->mn_next) == NULL) {
+			/* spin */
+		}
+	}
+	if (next != NULL) {
+		next->mn_wait = false;
+	}
+	mcs_putnode(node);
+#else
 	spinlock_data_set(&lk->lk_lock, 0);
+#endif
 	spllower(IPL_HIGH, IPL_NONE);
 }
 
@@ -139,3 +303,143 @@ spinlock_do_i_hold(struct spinlock *lk)
 	/* Assume we can read lk_holder atomically enough for this to work */
 	return (lk->lk_holder == curcpu->c_self);
 }
+
+#if OPT_LOCKPROF
+/*
+ * Zero the contention counters. Only the holder updates them, so
+ * take the lock to keep from racing with that.
+ */
+void
+spinlock_resetstats(struct spinlock *lk)
+{
+	spinlock_acquire(lk);
+	lk->lk_nacquire = 0;
+	lk->lk_ncontended = 0;
+	lk->lk_maxspin = 0;
+	spinlock_release(lk);
+}
+#endif
+
+/*
+ * Reader-writer spinlocks.
+ *
+ * rws_lock is only held to look at or change the counts; the waiting
+ * is done spinning on the counts themselves, without it. The hold
+ * keeps interrupts off with a splraise of its own, since rws_lock is
+ * let go in between.
+ *
+ * Waiting readers work as in rwlock_acquire_read: the writer that
+ * lets them in counts them into rws_readers and bumps rws_rgen, so a
+ * writer arriving in between cannot shut the batch out again.
+ */
+
+void
+rwspinlock_init(struct rwspinlock *rws)
+{
+	spinlock_init(&rws->rws_lock);
+	rws->rws_readers = 0;
+	rws->rws_writer = NULL;
+	rws->rws_wwaiting = 0;
+	rws->rws_rwaiting = 0;
+	rws->rws_rgen = 0;
+}
+
+void
+rwspinlock_cleanup(struct rwspinlock *rws)
+{
+	KASSERT(rws->rws_readers == 0);
+	KASSERT(rws->rws_writer == NULL);
+	KASSERT(rws->rws_wwaiting == 0);
+	KASSERT(rws->rws_rwaiting == 0);
+	spinlock_cleanup(&rws->rws_lock);
+}
+
+void
+rwspinlock_acquire_read(struct rwspinlock *rws)
+{
+	unsigned gen;
+
+	splraise(IPL_NONE, IPL_HIGH);
+
+	spinlock_acquire(&rws->rws_lock);
+	if (rws->rws_writer == NULL && rws->rws_wwaiting == 0) {
+		rws->rws_readers++;
+		spinlock_release(&rws->rws_lock);
+		return;
+	}
+	rws->rws_rwaiting++;
+	gen = rws->rws_rgen;
+	spinlock_release(&rws->rws_lock);
+
+	while (rws->rws_rgen == gen) {
+		/* spin */
+	}
+	KASSERT(rws->rws_readers > 0);
+}
+
+void
+rwspinlock_release_read(struct rwspinlock *rws)
+{
+	spinlock_acquire(&rws->rws_lock);
+	KASSERT(rws->rws_readers > 0);
+	rws->rws_readers--;
+	spinlock_release(&rws->rws_lock);
+
+	spllower(IPL_HIGH, IPL_NONE);
+}
+
+void
+rwspinlock_acquire_write(struct rwspinlock *rws)
+{
+	struct cpu *mycpu;
+
+	splraise(IPL_NONE, IPL_HIGH);
+
+	/* this must work before curcpu initialization */
+	mycpu = CURCPU_EXISTS() ? curcpu->c_self : NULL;
+	if (mycpu != NULL && rws->rws_writer == mycpu) {
+		panic("Deadlock on rwspinlock %p\n", rws);
+	}
+
+	spinlock_acquire(&rws->rws_lock);
+	rws->rws_wwaiting++;
+	while (rws->rws_writer != NULL || rws->rws_readers > 0) {
+		spinlock_release(&rws->rws_lock);
+		while (rws->rws_writer != NULL || rws->rws_readers > 0) {
+			/* spin */
+		}
+		spinlock_acquire(&rws->rws_lock);
+	}
+	rws->rws_wwaiting--;
+	rws->rws_writer = mycpu;
+	spinlock_release(&rws->rws_lock);
+}
+
+void
+rwspinlock_release_write(struct rwspinlock *rws)
+{
+	/* this must work before curcpu initialization */
+	if (CURCPU_EXISTS()) {
+		KASSERT(rws->rws_writer == curcpu->c_self);
+	}
+
+	spinlock_acquire(&rws->rws_lock);
+	rws->rws_writer = NULL;
+	if (rws->rws_rwaiting > 0) {
+		rws->rws_readers += rws->rws_rwaiting;
+		rws->rws_rwaiting = 0;
+		rws->rws_rgen++;
+	}
+	spinlock_release(&rws->rws_lock);
+
+	spllower(IPL_HIGH, IPL_NONE);
+}
+
+bool
+rwspinlock_do_i_hold_write(struct rwspinlock *rws)
+{
+	if (!CURCPU_EXISTS()) {
+		return true;
+	}
+	return (rws->rws_writer == curcpu->c_self);
+}
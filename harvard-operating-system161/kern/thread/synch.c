@@ -7,16 +7,19 @@
 #include <lib.h>
 #include <spinlock.h>
 #include <wchan.h>
+#include <cpu.h>
 #include <thread.h>
 #include <current.h>
 #include <synch.h>
+#include <lockprof.h>
 
 ////////////////////////////////////////////////////////////
 //
 
 // Semaphore.
 
-struct semaphore * sem_create(const char *name, int initial_count)
+static struct semaphore * sem_create_common(const char *name,
+                                            int initial_count, bool fair)
 {
         struct semaphore *sem;
 
@@ -42,10 +45,25 @@ struct semaphore * sem_create(const char *name, int initial_count)
 
 	spinlock_init(&sem->sem_lock);
         sem->sem_count = initial_count;
+        sem->sem_fair = fair;
+        sem->sem_nwaiting = 0;
+#if OPT_LOCKPROF
+        sem->sem_prof = lockprof_get(LOCKPROF_SEM, sem->sem_name, NULL);
+#endif
 
         return sem;
 }
 
+struct semaphore * sem_create(const char *name, int initial_count)
+{
+        return sem_create_common(name, initial_count, false);
+}
+
+struct semaphore * sem_create_fair(const char *name, int initial_count)
+{
+        return sem_create_common(name, initial_count, true);
+}
+
 void sem_destroy(struct semaphore *sem)
 {
         KASSERT(sem != NULL);
@@ -59,6 +77,11 @@ void sem_destroy(struct semaphore *sem)
 
 void P(struct semaphore *sem)
 {
+#if OPT_LOCKPROF
+        bool contended = false;
+        uint64_t waitstart = 0;
+#endif
+
         KASSERT(sem != NULL);
 
         /*
@@ -70,7 +93,33 @@ void P(struct semaphore *sem)
         KASSERT(curthread->t_in_interrupt == false);
 
 	spinlock_acquire(&sem->sem_lock);
+	if (sem->sem_fair && sem->sem_count == 0) {
+		/*
+		 * Queue up; the wchan is FIFO, and V gives each count
+		 * to the thread at its head without ever making it
+		 * available to anyone else. So when we wake up the
+		 * count is already ours.
+		 */
+#if OPT_LOCKPROF
+		contended = true;
+		waitstart = lockprof_now();
+#endif
+		sem->sem_nwaiting++;
+		wchan_lock(sem->sem_wchan);
+		spinlock_release(&sem->sem_lock);
+		wchan_sleep(sem->sem_wchan);
+#if OPT_LOCKPROF
+		lockprof_acquired(sem->sem_prof, contended, waitstart);
+#endif
+		return;
+	}
         while (sem->sem_count == 0) {
+#if OPT_LOCKPROF
+		if (!contended) {
+			contended = true;
+			waitstart = lockprof_now();
+		}
+#endif
 		/*
 		 * Bridge to the wchan lock, so if someone else comes
 		 * along in V right this instant the wakeup can't go
@@ -84,8 +133,7 @@ void P(struct semaphore *sem)
 		 * textbooks semaphores must for some reason have
 		 * strict ordering. Too bad. :-)
 		 *
-		 * Exercise: how would you implement strict FIFO
-		 * ordering?
+		 * (A fair semaphore does; see above.)
 		 */
 		wchan_lock(sem->sem_wchan);
 		spinlock_release(&sem->sem_lock);
@@ -96,6 +144,9 @@ void P(struct semaphore *sem)
         KASSERT(sem->sem_count > 0);
         sem->sem_count--;
 	spinlock_release(&sem->sem_lock);
+#if OPT_LOCKPROF
+	lockprof_acquired(sem->sem_prof, contended, waitstart);
+#endif
 }
 
 void V(struct semaphore *sem)
@@ -104,6 +155,15 @@ void V(struct semaphore *sem)
 
 	spinlock_acquire(&sem->sem_lock);
 
+	if (sem->sem_fair && sem->sem_nwaiting > 0) {
+		/* Direct handoff: the count goes to the oldest waiter. */
+		KASSERT(sem->sem_count == 0);
+		sem->sem_nwaiting--;
+		wchan_wakeone(sem->sem_wchan);
+		spinlock_release(&sem->sem_lock);
+		return;
+	}
+
         sem->sem_count++;
         KASSERT(sem->sem_count > 0);
 	wchan_wakeone(sem->sem_wchan);
@@ -143,12 +203,19 @@ struct lock* lock_create(const char* name)
 
         spinlock_init(&lock->lock_spinlock);
         lock->lock_holder = NULL;
+        lock->lk_nwaiting = 0;
+        bzero(lock->lk_nwaitlevel, sizeof(lock->lk_nwaitlevel));
+        lock->lk_pinext = NULL;
+#if OPT_LOCKPROF
+        lock->lk_prof = lockprof_get(LOCKPROF_LOCK, lock->lk_name, NULL);
+#endif
         return lock;
 }
 
 void lock_destroy(struct lock *lock)
 {
         KASSERT(lock != NULL);
+        KASSERT(lock->lk_nwaiting == 0);
         // add stuff here as needed
         spinlock_cleanup(&lock->lock_spinlock);
         wchan_destroy(lock->lock_wchan);
@@ -157,29 +224,247 @@ void lock_destroy(struct lock *lock)
 }
 
 
+/*
+ * Adaptive spinning. If the holder is running on another cpu it is
+ * likely to let go soon, and waiting for that is cheaper than the two
+ * context switches of sleeping. So spin, for at most LOCK_MAXSPIN
+ * looks at the lock, while the holder stays on its cpu. A holder that
+ * is asleep or waiting to run could take any amount of time, so then
+ * we sleep right away; that also covers the single-cpu case.
+ *
+ * Called and returns with lock_spinlock held. Returns true if the
+ * lock is worth another try, false if we should go to sleep.
+ *
+ * The holder can release, exit and be freed while we spin, so it is
+ * only compared against, never looked into; its cpu is read while
+ * we still hold lock_spinlock, which keeps it from releasing. cpus
+ * are never freed.
+ */
+#define LOCK_MAXSPIN 1000
+
+static
+bool
+lock_spin(struct lock *lock)
+{
+        struct thread *holder = (struct thread *)lock->lock_holder;
+        struct cpu *c = holder->t_cpu;
+        unsigned i;
+
+        if (c == curcpu || c->c_curthread != holder) {
+          return false;
+        }
+        spinlock_release(&lock->lock_spinlock);
+        for (i = 0; i < LOCK_MAXSPIN; i++) {
+          if (lock->lock_holder != holder ||
+              *(struct thread * volatile *)&c->c_curthread != holder) {
+            break;
+          }
+        }
+        spinlock_acquire(&lock->lock_spinlock);
+        // it may have been released after we last looked; that
+        // release's wakeup is gone, so we must not go to sleep
+        return i < LOCK_MAXSPIN || lock->lock_holder == NULL;
+}
+
+/*
+ * Priority inheritance.
+ *
+ * A thread that goes to sleep waiting for a lock is counted in the
+ * lock's lk_nwaitlevel at its thread_level, and while a lock has
+ * waiters it is on its holder's t_pilocks list. A thread's t_inherit
+ * is the best level among the waiters of the locks on that list. When
+ * it changes and the thread is itself waiting for a lock, its count
+ * there moves too, and the change goes on to that lock's holder, and
+ * so on down the chain.
+ *
+ * All of this is under pi_lock, which is only taken for a lock that
+ * has waiters; uncontended locks never touch it. The holder of a lock
+ * with waiters changes only under pi_lock as well, so the chain can
+ * be followed safely. Lock order: lock_spinlock, pi_lock, run queue.
+ *
+ * Threads that cv_morph moves onto a lock are not counted until they
+ * wake up and find it held again.
+ */
+static struct spinlock pi_lock = SPINLOCK_INITIALIZER;
+
+/* A chain longer than this must be a deadlock; stop following it. */
+#define PI_MAXDEPTH 16
+
+/* The best level among LOCK's waiters, or SCHED_NPRIO if none. */
+static
+unsigned
+pi_waitlevel(struct lock *lock)
+{
+        unsigned i;
+
+        for (i = 0; i < SCHED_NPRIO; i++) {
+          if (lock->lk_nwaitlevel[i] > 0) {
+            return i;
+          }
+        }
+        return SCHED_NPRIO;
+}
+
+static
+void
+pi_addlock(struct thread *t, struct lock *lock)
+{
+        lock->lk_pinext = t->t_pilocks;
+        t->t_pilocks = lock;
+}
+
+static
+void
+pi_remlock(struct thread *t, struct lock *lock)
+{
+        struct lock **lp;
+
+        for (lp = &t->t_pilocks; *lp != lock; lp = &(*lp)->lk_pinext) {
+          KASSERT(*lp != NULL);
+        }
+        *lp = lock->lk_pinext;
+        lock->lk_pinext = NULL;
+}
+
+/* Recompute T's inherited level, and pass any change down the chain. */
+static
+void
+pi_update(struct thread *t)
+{
+        struct lock *l;
+        unsigned level, depth;
+
+        for (depth = 0; t != NULL && depth < PI_MAXDEPTH; depth++) {
+          level = SCHED_NPRIO;
+          for (l = t->t_pilocks; l != NULL; l = l->lk_pinext) {
+            if (pi_waitlevel(l) < level) {
+              level = pi_waitlevel(l);
+            }
+          }
+          if (level == t->t_inherit) {
+            return;
+          }
+          thread_setinherit(t, level);
+
+          l = t->t_blockedon;
+          if (l == NULL || thread_level(t) == t->t_waitlevel) {
+            return;
+          }
+          l->lk_nwaitlevel[t->t_waitlevel]--;
+          t->t_waitlevel = thread_level(t);
+          l->lk_nwaitlevel[t->t_waitlevel]++;
+          t = (struct thread *)l->lock_holder;
+        }
+}
+
+/*
+ * Count curthread as waiting for LOCK, which is held, and lend the
+ * holder its priority. Called with lock_spinlock held.
+ */
+static
+void
+pi_block(struct lock *lock)
+{
+        struct thread *holder = (struct thread *)lock->lock_holder;
+
+        KASSERT(holder != NULL);
+        spinlock_acquire(&pi_lock);
+        if (lock->lk_nwaiting++ == 0) {
+          pi_addlock(holder, lock);
+        }
+        curthread->t_blockedon = lock;
+        curthread->t_waitlevel = thread_level(curthread);
+        lock->lk_nwaitlevel[curthread->t_waitlevel]++;
+        pi_update(holder);
+        spinlock_release(&pi_lock);
+}
+
+/* Undo pi_block after waking up. Called with lock_spinlock held. */
+static
+void
+pi_unblock(struct lock *lock)
+{
+        struct thread *holder = (struct thread *)lock->lock_holder;
+
+        spinlock_acquire(&pi_lock);
+        lock->lk_nwaitlevel[curthread->t_waitlevel]--;
+        curthread->t_blockedon = NULL;
+        lock->lk_nwaiting--;
+        if (holder != NULL) {
+          if (lock->lk_nwaiting == 0) {
+            pi_remlock(holder, lock);
+          }
+          pi_update(holder);
+        }
+        spinlock_release(&pi_lock);
+}
+
 void lock_acquire(struct lock *lock)
 {
+#if OPT_LOCKPROF
+        bool contended = false;
+        uint64_t waitstart = 0;
+#endif
+
         // Write this
         KASSERT(lock != NULL);
         KASSERT(curthread->t_in_interrupt == false);
         spinlock_acquire(&lock->lock_spinlock);
         while(lock->lock_holder!=NULL){
+#if OPT_LOCKPROF
+          if (!contended) {
+            contended = true;
+            waitstart = lockprof_now();
+          }
+#endif
+          if (lock_spin(lock)) {
+            continue;
+          }
+          pi_block(lock);
           wchan_lock(lock->lock_wchan);
           spinlock_release(&lock->lock_spinlock); ///if we don't wchan lock  if some program lock release, it will wake one and get the wchan lock and wake no one, and later when you sleep no one will wake you
           wchan_sleep(lock->lock_wchan);
           spinlock_acquire(&lock->lock_spinlock);
+          if (curthread->t_blockedon == lock) {
+            pi_unblock(lock);
+          }
+        }
+        if (lock->lk_nwaiting > 0) {
+          // take over lending the waiters' priority
+          spinlock_acquire(&pi_lock);
+          lock->lock_holder=curthread;
+          pi_addlock(curthread, lock);
+          pi_update(curthread);
+          spinlock_release(&pi_lock);
+        } else {
+          lock->lock_holder=curthread;
         }
-        lock->lock_holder=curthread;
         spinlock_release(&lock->lock_spinlock);
+#if OPT_LOCKPROF
+        lock->lk_acqat = lockprof_acquired(lock->lk_prof, contended,
+                                           waitstart);
+#endif
 }
 
 
 void lock_release(struct lock *lock)
 {
         KASSERT(lock!=NULL);
+#if OPT_LOCKPROF
+        lockprof_released(lock->lk_prof, lock->lk_acqat);
+#endif
         spinlock_acquire(&lock->lock_spinlock);
         KASSERT(lock->lock_holder==curthread);
-        lock->lock_holder=NULL;
+        if (lock->lk_nwaiting > 0) {
+          // give back what the waiters lent us
+          spinlock_acquire(&pi_lock);
+          pi_remlock(curthread, lock);
+          lock->lock_holder=NULL;
+          pi_update(curthread);
+          spinlock_release(&pi_lock);
+        } else {
+          lock->lock_holder=NULL;
+        }
         wchan_wakeone(lock->lock_wchan);
         spinlock_release(&lock->lock_spinlock);
 }
@@ -247,12 +532,48 @@ cv_wait(struct cv *cv, struct lock *lock)
         lock_acquire(lock);
 }
 
+/*
+ * Wait morphing. A waiter that is woken up goes straight into
+ * lock_acquire in cv_wait, so if the lock is held (normally by the
+ * signaller) it would only go back to sleep on the lock. Instead,
+ * move it onto the lock's wchan while it is still asleep; then each
+ * lock_release wakes one of them, and a broadcast no longer sets off
+ * a herd of threads that all fight over the lock.
+ *
+ * Lock order is the same as in cv_wait: the cv's wchan, then
+ * lock_spinlock, then the lock's wchan. Holding lock_spinlock keeps
+ * the lock from being released between the check and the move.
+ * Returns false, having done nothing, if the lock is free.
+ */
+static
+bool
+cv_morph(struct cv *cv, struct lock *lock, bool all)
+{
+        bool held;
+
+        wchan_lock(cv->cv_wchan);
+        spinlock_acquire(&lock->lock_spinlock);
+        held = (lock->lock_holder != NULL);
+        if (held) {
+          if (all) {
+            wchan_moveall(cv->cv_wchan, lock->lock_wchan);
+          } else {
+            wchan_moveone(cv->cv_wchan, lock->lock_wchan);
+          }
+        }
+        spinlock_release(&lock->lock_spinlock);
+        wchan_unlock(cv->cv_wchan);
+        return held;
+}
+
 void
 cv_signal(struct cv *cv, struct lock *lock)
 {
         KASSERT(cv != NULL);
         KASSERT(lock != NULL);
-        wchan_wakeone(cv->cv_wchan);
+        if (!cv_morph(cv, lock, false)) {
+          wchan_wakeone(cv->cv_wchan);
+        }
 }
 
 void
@@ -260,5 +581,168 @@ cv_broadcast(struct cv *cv, struct lock *lock)
 {
         KASSERT(cv != NULL);
         KASSERT(lock != NULL);
-        wchan_wakeall(cv->cv_wchan);
+        if (!cv_morph(cv, lock, true)) {
+          wchan_wakeall(cv->cv_wchan);
+        }
+}
+
+////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////
+// Reader-writer lock.
+
+struct rwlock *
+rwlock_create(const char *name)
+{
+	struct rwlock *rw;
+
+	rw = kmalloc(sizeof(*rw));
+	if (rw == NULL) {
+		return NULL;
+	}
+	rw->rwlock_name = kstrdup(name);
+	if (rw->rwlock_name == NULL) {
+		kfree(rw);
+		return NULL;
+	}
+	rw->rw_rwchan = wchan_create(rw->rwlock_name);
+	if (rw->rw_rwchan == NULL) {
+		kfree(rw->rwlock_name);
+		kfree(rw);
+		return NULL;
+	}
+	rw->rw_wwchan = wchan_create(rw->rwlock_name);
+	if (rw->rw_wwchan == NULL) {
+		wchan_destroy(rw->rw_rwchan);
+		kfree(rw->rwlock_name);
+		kfree(rw);
+		return NULL;
+	}
+
+	spinlock_init(&rw->rw_lock);
+	rw->rw_readers = 0;
+	rw->rw_writer = NULL;
+	rw->rw_rwaiting = 0;
+	rw->rw_wwaiting = 0;
+	rw->rw_rgen = 0;
+	return rw;
+}
+
+void
+rwlock_destroy(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(rw->rw_readers == 0);
+	KASSERT(rw->rw_writer == NULL);
+
+	/* wchan_cleanup will assert if anyone's waiting on it */
+	spinlock_cleanup(&rw->rw_lock);
+	wchan_destroy(rw->rw_rwchan);
+	wchan_destroy(rw->rw_wwchan);
+	kfree(rw->rwlock_name);
+	kfree(rw);
+}
+
+/*
+ * A reader that has to wait is not woken to try again; the writer
+ * that lets it in counts it into rw_readers and bumps rw_rgen, so on
+ * waking up it already holds the lock. That way a writer arriving in
+ * between cannot shut the batch out again.
+ */
+void
+rwlock_acquire_read(struct rwlock *rw)
+{
+	unsigned gen;
+
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+	if (rw->rw_writer == NULL && rw->rw_wwaiting == 0) {
+		rw->rw_readers++;
+		spinlock_release(&rw->rw_lock);
+		return;
+	}
+
+	rw->rw_rwaiting++;
+	gen = rw->rw_rgen;
+	while (rw->rw_rgen == gen) {
+		wchan_lock(rw->rw_rwchan);
+		spinlock_release(&rw->rw_lock);
+		wchan_sleep(rw->rw_rwchan);
+		spinlock_acquire(&rw->rw_lock);
+	}
+	KASSERT(rw->rw_readers > 0);
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_release_read(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_readers > 0);
+	KASSERT(rw->rw_writer == NULL);
+	rw->rw_readers--;
+	if (rw->rw_readers == 0 && rw->rw_wwaiting > 0) {
+		wchan_wakeone(rw->rw_wwchan);
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+void
+rwlock_acquire_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	KASSERT(curthread->t_in_interrupt == false);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer != curthread);
+	while (rw->rw_writer != NULL || rw->rw_readers > 0) {
+		rw->rw_wwaiting++;
+		wchan_lock(rw->rw_wwchan);
+		spinlock_release(&rw->rw_lock);
+		wchan_sleep(rw->rw_wwchan);
+		spinlock_acquire(&rw->rw_lock);
+		rw->rw_wwaiting--;
+	}
+	rw->rw_writer = curthread;
+	spinlock_release(&rw->rw_lock);
+}
+
+/*
+ * Readers that are waiting go first, as a batch; otherwise the next
+ * writer. If there are no readers waiting but a writer comes along
+ * before the one we wake runs, the woken one goes back to sleep and
+ * the newcomer wakes it again on release.
+ */
+void
+rwlock_release_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+
+	spinlock_acquire(&rw->rw_lock);
+	KASSERT(rw->rw_writer == curthread);
+	rw->rw_writer = NULL;
+	if (rw->rw_rwaiting > 0) {
+		rw->rw_readers += rw->rw_rwaiting;
+		rw->rw_rwaiting = 0;
+		rw->rw_rgen++;
+		wchan_wakeall(rw->rw_rwchan);
+	}
+	else if (rw->rw_wwaiting > 0) {
+		wchan_wakeone(rw->rw_wwchan);
+	}
+	spinlock_release(&rw->rw_lock);
+}
+
+bool
+rwlock_do_i_hold_write(struct rwlock *rw)
+{
+	KASSERT(rw != NULL);
+	return rw->rw_writer == curthread;
 }
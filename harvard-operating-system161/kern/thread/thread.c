@@ -35,6 +35,8 @@
 
 #include <types.h>
 #include <kern/errno.h>
+#include <kern/time.h>
+#include <kern/resource.h>
 #include <lib.h>
 #include <array.h>
 #include <cpu.h>
@@ -50,8 +52,11 @@
 #include <addrspace.h>
 #include <mainbus.h>
 #include <vnode.h>
+#include <clock.h>
+#include <schedtrace.h>
 
 #include "opt-synchprobs.h"
+#include "opt-schedstat.h"
 
 
 /* Magic number used as a guard value on kernel thread stacks. */
@@ -112,26 +117,16 @@ thread_checkstack(struct thread *thread)
 }
 
 /*
- * Create a thread. This is used both to create a first thread
- * for each CPU and to create subsequent forked threads.
+ * Set up a thread structure that is new or being recycled, under the
+ * name NAME. The stack, if any, is left alone.
  */
 static
-struct thread *
-thread_create(const char *name)
+int
+thread_init(struct thread *thread, const char *name)
 {
-	struct thread *thread;
-
-	DEBUGASSERT(name != NULL);
-
-	thread = kmalloc(sizeof(*thread));
-	if (thread == NULL) {
-		return NULL;
-	}
-
 	thread->t_name = kstrdup(name);
 	if (thread->t_name == NULL) {
-		kfree(thread);
-		return NULL;
+		return ENOMEM;
 	}
 	thread->t_wchan_name = "NEW";
 	thread->t_state = S_READY;
@@ -139,7 +134,6 @@ thread_create(const char *name)
 	/* Thread subsystem fields */
 	thread_machdep_init(&thread->t_machdep);
 	threadlistnode_init(&thread->t_listnode, thread);
-	thread->t_stack = NULL;
 	thread->t_context = NULL;
 	thread->t_cpu = NULL;
 	thread->t_proc = NULL;
@@ -149,11 +143,287 @@ thread_create(const char *name)
 	thread->t_curspl = IPL_HIGH;
 	thread->t_iplhigh_count = 1; /* corresponding to t_curspl */
 
+	/* Public fields */
+	bzero(&thread->t_usage, sizeof(thread->t_usage));
+	thread->t_nice = 0;
+	thread->t_prio = 0;
+	thread->t_ticks = 0;
+	thread->t_lastrun = 0;
+	thread->t_readyat = 0;
+	thread->t_fromsleep = false;
+	thread->t_inherit = SCHED_NPRIO;
+	thread->t_blockedon = NULL;
+	thread->t_waitlevel = 0;
+	thread->t_pilocks = NULL;
+	thread->t_timernext = NULL;
+	thread->t_timerprev = NULL;
+	thread->t_timerintr = false;
+
 	/* If you add to struct thread, be sure to initialize here */
 
+	return 0;
+}
+
+/*
+ * Create a thread. This is used both to create a first thread
+ * for each CPU and to create subsequent forked threads.
+ */
+static
+struct thread *
+thread_create(const char *name)
+{
+	struct thread *thread;
+
+	DEBUGASSERT(name != NULL);
+
+	thread = kmalloc(sizeof(*thread));
+	if (thread == NULL) {
+		return NULL;
+	}
+	if (thread_init(thread, name)) {
+		kfree(thread);
+		return NULL;
+	}
+	thread->t_stack = NULL;
+	thread->t_timerchan = NULL;
+
+	return thread;
+}
+
+/*
+ * Recycled threads.
+ *
+ * Rather than freeing a dead thread and its stack, exorcise() parks
+ * up to THREAD_CACHE_MAX of them on a per-cpu list, and thread_fork
+ * takes from that list before going to kmalloc. A parked thread keeps
+ * its stack, guard band included, but has given up its name and
+ * machine-dependent state. Only the owning cpu touches its list, with
+ * interrupts off so we cannot be preempted or migrated meanwhile.
+ */
+#define THREAD_CACHE_MAX 8
+
+static
+struct thread *
+thread_cache_get(void)
+{
+	struct thread *thread;
+	int spl;
+
+	spl = splhigh();
+	thread = threadlist_remhead(&curcpu->c_threadcache);
+	if (thread != NULL) {
+		curcpu->c_tcache_hits++;
+	}
+	else {
+		curcpu->c_tcache_misses++;
+	}
+	splx(spl);
 	return thread;
 }
 
+/*
+ * Park THREAD, which is dead and not on any list, for reuse. Returns
+ * false if there is no room, in which case it is left untouched.
+ */
+static
+bool
+thread_cache_put(struct thread *thread)
+{
+	bool kept;
+	int spl;
+
+	KASSERT(thread->t_proc == NULL);
+	if (thread->t_stack == NULL) {
+		return false;
+	}
+
+	spl = splhigh();
+	kept = curcpu->c_threadcache.tl_count < THREAD_CACHE_MAX;
+	if (kept) {
+		/* make sure the stack is still fit for reuse */
+		thread_checkstack(thread);
+		kfree(thread->t_name);
+		thread->t_name = NULL;
+		thread_machdep_cleanup(&thread->t_machdep);
+		thread->t_wchan_name = "RECYCLED";
+		threadlist_addhead(&curcpu->c_threadcache, thread);
+	}
+	splx(spl);
+	return kept;
+}
+
+void
+usage_add(struct usage *to, const struct usage *from)
+{
+	to->u_uticks += from->u_uticks;
+	to->u_sticks += from->u_sticks;
+	to->u_minflt += from->u_minflt;
+	to->u_nvcsw += from->u_nvcsw;
+	to->u_nivcsw += from->u_nivcsw;
+	to->u_nsyscalls += from->u_nsyscalls;
+	to->u_nmigrations += from->u_nmigrations;
+	to->u_runns += from->u_runns;
+	to->u_waitns += from->u_waitns;
+}
+
+void
+thread_cache_printstats(void)
+{
+	unsigned i, hits, misses;
+	struct cpu *c;
+
+	for (i=0; i<cpuarray_num(&allcpus); i++) {
+		c = cpuarray_get(&allcpus, i);
+		hits = c->c_tcache_hits;
+		misses = c->c_tcache_misses;
+		kprintf("cpu%u: thread cache %u hits, %u misses (%u%%), "
+			"%u cached\n", c->c_number, hits, misses,
+			hits + misses == 0 ? 0 : hits * 100 / (hits + misses),
+			c->c_threadcache.tl_count);
+	}
+}
+
+/*
+ * Scheduler statistics. thread_make_runnable stamps t_readyat, and
+ * thread_switch charges the time since then to the thread it picks,
+ * and the time since c_switchat to the thread it switches out of.
+ *
+ * Reading the clock means going out to the timer on the bus, so the
+ * timestamps are only taken with options schedstat. Without it they
+ * are all 0, and so are the times worked out from them.
+ */
+#if OPT_SCHEDSTAT
+#define SCHEDSTAT_NOW() clock_nsecs()
+#else
+#define SCHEDSTAT_NOW() 0
+#endif
+
+/* Time from THEN to NOW, or 0 if the clock wasn't running at THEN. */
+static
+uint64_t
+schedstat_since(uint64_t then, uint64_t now)
+{
+	if (then == 0 || now < then) {
+		return 0;
+	}
+	return now - then;
+}
+
+#if OPT_SCHEDSTAT
+static
+void
+schedstat_latency(struct schedstat *ss, uint64_t ns)
+{
+	uint64_t us;
+	uint32_t usec;
+	unsigned b;
+
+	us = ns / 1000;
+	usec = us > 0xffffffff ? 0xffffffff : us;
+	for (b = 0; b < SCHEDSTAT_LATBUCKETS - 1; b++) {
+		if (usec < (1U << b)) {
+			break;
+		}
+	}
+	ss->ss_lathist[b]++;
+}
+
+/* Print NS as milliseconds. */
+static
+void
+schedstat_printms(const char *what, uint64_t ns)
+{
+	kprintf(" %s %llu.%03llu ms", what,
+		(unsigned long long)(ns / 1000000),
+		(unsigned long long)(ns / 1000 % 1000));
+}
+#endif
+
+void
+schedstat_print(void)
+{
+	struct schedstat total, *ss;
+	struct cpu *c;
+	unsigned i, b;
+#if OPT_SCHEDSTAT
+	unsigned nlat;
+#endif
+
+	bzero(&total, sizeof(total));
+	for (i=0; (c = cpu_get(i)) != NULL; i++) {
+		ss = &c->c_stats;
+		kprintf("cpu%u:", c->c_number);
+#if OPT_SCHEDSTAT
+		schedstat_printms("busy", ss->ss_busyns);
+		schedstat_printms("idle", ss->ss_idlens);
+		schedstat_printms("runq wait", ss->ss_waitns);
+#endif
+		kprintf("\n      %u switches (%u sleep, %u preempt), "
+			"%u wakeups, %u steals\n", ss->ss_nswitch,
+			ss->ss_nvcsw, ss->ss_nivcsw, ss->ss_nwakeups,
+			c->c_steals);
+#if OPT_LOCKPROF
+		kprintf("      run queue lock: %u acquired, %u contended, "
+			"longest spin %u\n", c->c_runqueue_lock.lk_nacquire,
+			c->c_runqueue_lock.lk_ncontended,
+			c->c_runqueue_lock.lk_maxspin);
+#endif
+		for (b=0; b<SCHEDSTAT_LATBUCKETS; b++) {
+			total.ss_lathist[b] += ss->ss_lathist[b];
+		}
+		total.ss_nwakeups += ss->ss_nwakeups;
+	}
+
+#if OPT_SCHEDSTAT
+	kprintf("wakeup to run latency, %u wakeups:\n", total.ss_nwakeups);
+	nlat = 0;
+	for (b=0; b<SCHEDSTAT_LATBUCKETS; b++) {
+		if (total.ss_lathist[b] == 0) {
+			continue;
+		}
+		nlat += total.ss_lathist[b];
+		if (b == SCHEDSTAT_LATBUCKETS - 1) {
+			kprintf("  >= %7u us", 1U << (b - 1));
+		}
+		else {
+			kprintf("   < %7u us", 1U << b);
+		}
+		kprintf(" %8u  %3u%%\n", total.ss_lathist[b],
+			nlat * 100 / total.ss_nwakeups);
+	}
+#else
+	kprintf("(times and wakeup latency need options schedstat)\n");
+#endif
+}
+
+void
+schedstat_reset(void)
+{
+	struct cpu *c;
+	unsigned i;
+	int spl;
+
+	for (i=0; (c = cpu_get(i)) != NULL; i++) {
+		/* not atomic with respect to the cpu; near enough */
+		spl = splhigh();
+		bzero(&c->c_stats, sizeof(c->c_stats));
+		c->c_steals = 0;
+		splx(spl);
+#if OPT_LOCKPROF
+		spinlock_resetstats(&c->c_runqueue_lock);
+#endif
+	}
+}
+
+struct cpu *
+cpu_get(unsigned number)
+{
+	if (number >= cpuarray_num(&allcpus)) {
+		return NULL;
+	}
+	return cpuarray_get(&allcpus, number);
+}
+
 /*
  * Create a CPU structure. This is used for the bootup CPU and
  * also for secondary CPUs.
@@ -168,6 +438,7 @@ cpu_create(unsigned hardware_number)
 	struct cpu *c;
 	int result;
 	char namebuf[16];
+	unsigned i;
 
 	c = kmalloc(sizeof(*c));
 	if (c == NULL) {
@@ -180,9 +451,23 @@ cpu_create(unsigned hardware_number)
 	c->c_curthread = NULL;
 	threadlist_init(&c->c_zombies);
 	c->c_hardclocks = 0;
+	c->c_userirq = false;
+	threadlist_init(&c->c_threadcache);
+	c->c_tcache_hits = 0;
+	c->c_tcache_misses = 0;
 
 	c->c_isidle = false;
-	threadlist_init(&c->c_runqueue);
+	for (i=0; i<SCHED_NPRIO; i++) {
+		threadlist_init(&c->c_runqueue[i]);
+	}
+	c->c_runcount = 0;
+	c->c_steals = 0;
+	c->c_trace = NULL;
+	bzero(&c->c_stats, sizeof(c->c_stats));
+	c->c_switchat = 0;
+#if OPT_MCSLOCK
+	c->c_mcsused = 0;
+#endif
 	spinlock_init(&c->c_runqueue_lock);
 
 	c->c_ipi_pending = 0;
@@ -252,6 +537,9 @@ thread_destroy(struct thread *thread)
 	if (thread->t_stack != NULL) {
 		kfree(thread->t_stack);
 	}
+	if (thread->t_timerchan != NULL) {
+		wchan_destroy(thread->t_timerchan);
+	}
 	threadlistnode_cleanup(&thread->t_listnode);
 	thread_machdep_cleanup(&thread->t_machdep);
 
@@ -277,7 +565,9 @@ exorcise(void)
 	while ((z = threadlist_remhead(&curcpu->c_zombies)) != NULL) {
 		KASSERT(z != curthread);
 		KASSERT(z->t_state == S_ZOMBIE);
-		thread_destroy(z);
+		if (!thread_cache_put(z)) {
+			thread_destroy(z);
+		}
 	}
 }
 
@@ -289,6 +579,8 @@ exorcise(void)
 void
 thread_panic(void)
 {
+	unsigned i;
+
 	/*
 	 * Kill off other CPUs.
 	 *
@@ -303,9 +595,12 @@ thread_panic(void)
 	 * to.  Instead, blat the list structure by hand, and take the
 	 * risk that it might not be quite atomic.
 	 */
-	curcpu->c_runqueue.tl_count = 0;
-	curcpu->c_runqueue.tl_head.tln_next = NULL;
-	curcpu->c_runqueue.tl_tail.tln_prev = NULL;
+	for (i=0; i<SCHED_NPRIO; i++) {
+		curcpu->c_runqueue[i].tl_count = 0;
+		curcpu->c_runqueue[i].tl_head.tln_next = NULL;
+		curcpu->c_runqueue[i].tl_tail.tln_prev = NULL;
+	}
+	curcpu->c_runcount = 0;
 
 	/*
 	 * Ideally, we want to make sure sleeping threads don't wake
@@ -426,6 +721,292 @@ thread_start_cpus(void)
 	cpu_startup_sem = NULL;
 }
 
+/*
+ * Nice values (see sys_setpriority). A positive nice value gives the
+ * thread a floor: the highest run queue level it may reach, so it can
+ * neither wake up nor be boosted past threads that are not niced.
+ * Nice 1 is one level down and nice 19 is the bottom level. A negative
+ * nice value leaves the floor at the top but stretches the thread's
+ * time slices instead, up to three times as long at nice -20.
+ */
+static
+unsigned
+thread_floor(const struct thread *t)
+{
+	if (t->t_nice <= 0) {
+		return 0;
+	}
+	return 1 + (t->t_nice - 1) * (SCHED_NPRIO - 1) / (PRIO_MAX - 1);
+}
+
+/*
+ * Other threads get the new floor on their way onto a run queue (see
+ * runq_add); the current thread is not on one, so it moves down now.
+ */
+void
+thread_setnice(struct thread *t, int nice)
+{
+	int spl;
+
+	t->t_nice = nice;
+	if (t == curthread) {
+		/* keep thread_tick and schedule off t_prio meanwhile */
+		spl = splhigh();
+		if (t->t_prio < thread_floor(t)) {
+			t->t_prio = thread_floor(t);
+		}
+		splx(spl);
+	}
+}
+
+/*
+ * A thread holding a lock that a higher-priority thread is waiting for
+ * runs at the waiter's level (see lock_acquire). The floor does not
+ * apply to that: a niced holder must not hold up the waiter either.
+ */
+unsigned
+thread_level(const struct thread *t)
+{
+	return t->t_inherit < t->t_prio ? t->t_inherit : t->t_prio;
+}
+
+/*
+ * Run queue access. A cpu has one run queue per priority level, and
+ * runs the threads at the highest level first; c_runcount is the total.
+ * A thread goes on the queue for its thread_level.
+ * The caller must hold the cpu's c_runqueue_lock.
+ */
+static
+void
+runq_add(struct cpu *c, struct thread *t)
+{
+	/* setpriority may have moved its floor down meanwhile */
+	if (t->t_prio < thread_floor(t)) {
+		t->t_prio = thread_floor(t);
+	}
+	KASSERT(t->t_prio < SCHED_NPRIO);
+	threadlist_addtail(&c->c_runqueue[thread_level(t)], t);
+	c->c_runcount++;
+}
+
+/* Take the next thread to run: the first one at the highest level. */
+static
+struct thread *
+runq_remhead(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	for (i=0; i<SCHED_NPRIO; i++) {
+		t = threadlist_remhead(&c->c_runqueue[i]);
+		if (t != NULL) {
+			c->c_runcount--;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/* Take the thread that would run last, for migrating elsewhere. */
+static
+struct thread *
+runq_remtail(struct cpu *c)
+{
+	struct thread *t;
+	unsigned i;
+
+	for (i=SCHED_NPRIO; i-- > 0; ) {
+		t = threadlist_remtail(&c->c_runqueue[i]);
+		if (t != NULL) {
+			c->c_runcount--;
+			return t;
+		}
+	}
+	return NULL;
+}
+
+/* Take T off C's run queue, if it is on it. */
+static
+bool
+runq_remove(struct cpu *c, struct thread *t)
+{
+	struct thread *t2;
+	unsigned i;
+
+	for (i=0; i<SCHED_NPRIO; i++) {
+		THREADLIST_FORALL(t2, c->c_runqueue[i]) {
+			if (t2 == t) {
+				threadlist_remove(&c->c_runqueue[i], t);
+				c->c_runcount--;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/* Is there anything runnable at level PRIO or above? */
+static
+bool
+runq_haswork(struct cpu *c, unsigned prio)
+{
+	unsigned i;
+
+	for (i=0; i<=prio && i<SCHED_NPRIO; i++) {
+		if (!threadlist_isempty(&c->c_runqueue[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Work stealing, for an idle cpu. Pick the cpu with the most threads
+ * waiting and take the one it would run last. The counts are read
+ * without locks, so they are only a hint; the victim's run queue is
+ * checked again under its lock.
+ *
+ * Called from the idle loop in thread_switch with our run queue
+ * locked. We never hold two run queue locks at once, so we drop ours
+ * while at the victim's; it is held again on return.
+ */
+static
+struct thread *
+thread_steal(void)
+{
+	struct cpu *c, *busiest;
+	struct thread *t;
+	unsigned i, numcpus, most;
+
+	busiest = NULL;
+	most = 0;
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c == curcpu->c_self || c->c_isidle) {
+			/* An idle cpu will run its own threads. */
+			continue;
+		}
+		if (c->c_runcount > most) {
+			most = c->c_runcount;
+			busiest = c;
+		}
+	}
+	if (busiest == NULL) {
+		return NULL;
+	}
+
+	spinlock_release(&curcpu->c_runqueue_lock);
+	spinlock_acquire(&busiest->c_runqueue_lock);
+	t = NULL;
+	if (!busiest->c_isidle) {
+		t = runq_remtail(busiest);
+		if (t != NULL && t == busiest->c_curthread) {
+			/* See the comment in thread_consider_migration. */
+			runq_add(busiest, t);
+			t = NULL;
+		}
+	}
+	spinlock_release(&busiest->c_runqueue_lock);
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+
+	if (t != NULL) {
+		t->t_cpu = curcpu->c_self;
+		t->t_usage.u_nmigrations++;
+		curcpu->c_steals++;
+		SCHEDTRACE(STE_MIGRATE, t, NULL, curcpu->c_number);
+		DEBUG(DB_THREADS, "Stole thread %s: cpu %u -> %u",
+		      t->t_name, busiest->c_number, curcpu->c_number);
+	}
+	return t;
+}
+
+/*
+ * Wakeup placement. A waking thread goes back to the cpu it last ran
+ * on if that cpu is idle or has nothing else waiting, or if the thread
+ * ran there recently enough that its working set is probably still in
+ * the cache and the queue ahead of it is short. Otherwise it goes to
+ * an idle cpu, if there is one.
+ *
+ * Called from thread_make_runnable with LAST's run queue locked, which
+ * also guarantees that TARGET has finished switching out of LAST.
+ * Returns the chosen cpu, with its run queue locked instead.
+ */
+#define SCHED_HOTTICKS	2	/* cache considered warm this many ticks */
+#define SCHED_HOTLOAD	2	/* ...if fewer than this many are waiting */
+
+static
+struct cpu *
+thread_wakecpu(struct thread *target, struct cpu *last)
+{
+	struct cpu *c;
+	unsigned i, numcpus;
+
+	if (last->c_isidle || target == last->c_curthread) {
+		/*
+		 * An idle cpu may be idling on TARGET's stack (see
+		 * thread_consider_migration), so this is not only the
+		 * best choice but the only safe one.
+		 */
+		return last;
+	}
+	if (last->c_runcount == 0) {
+		return last;
+	}
+	if (last->c_hardclocks - target->t_lastrun < SCHED_HOTTICKS &&
+	    last->c_runcount < SCHED_HOTLOAD) {
+		return last;
+	}
+
+	/* Look for an idle cpu, starting with our own (e.g. in an irq). */
+	c = curcpu->c_self;
+	if (!c->c_isidle) {
+		numcpus = cpuarray_num(&allcpus);
+		for (i=0; i<numcpus; i++) {
+			c = cpuarray_get(&allcpus, i);
+			if (c != last && c->c_isidle) {
+				break;
+			}
+		}
+		if (i == numcpus) {
+			return last;
+		}
+	}
+	KASSERT(c != last);
+
+	spinlock_release(&last->c_runqueue_lock);
+	target->t_cpu = c;
+	target->t_usage.u_nmigrations++;
+	SCHEDTRACE(STE_MIGRATE, target, NULL, c->c_number);
+	spinlock_acquire(&c->c_runqueue_lock);
+	DEBUG(DB_THREADS, "Woke thread %s on cpu %u, not %u",
+	      target->t_name, c->c_number, last->c_number);
+	return c;
+}
+
+/*
+ * TARGETCPU, which is busy, has more than one thread waiting on its
+ * run queue, so at least one of them will have to wait. If another
+ * cpu is idle, wake it up so it can steal one; since idle cpus don't
+ * tick, they would not otherwise notice.
+ */
+static
+void
+thread_kickidle(struct cpu *targetcpu)
+{
+	struct cpu *c;
+	unsigned i, numcpus;
+
+	numcpus = cpuarray_num(&allcpus);
+	for (i=0; i<numcpus; i++) {
+		c = cpuarray_get(&allcpus, i);
+		if (c != targetcpu && c != curcpu->c_self && c->c_isidle) {
+			ipi_send(c, IPI_UNIDLE);
+			return;
+		}
+	}
+}
+
 /*
  * Make a thread runnable.
  *
@@ -449,8 +1030,27 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		spinlock_acquire(&targetcpu->c_runqueue_lock);
 	}
 
+	if (target->t_state == S_SLEEP) {
+		/*
+		 * Waking up from a wait: it gave up the cpu before its
+		 * allotment ran out, so move it up a level. This keeps
+		 * interactive and I/O-bound threads near the top.
+		 */
+		if (target->t_prio > thread_floor(target)) {
+			target->t_prio--;
+		}
+		target->t_ticks = 0;
+
+		if (!already_have_lock) {
+			targetcpu = thread_wakecpu(target, targetcpu);
+		}
+		SCHEDTRACE(STE_WAKEUP, target, NULL, targetcpu->c_number);
+	}
+	target->t_readyat = SCHEDSTAT_NOW();
+	target->t_fromsleep = (target->t_state == S_SLEEP);
+
 	isidle = targetcpu->c_isidle;
-	threadlist_addtail(&targetcpu->c_runqueue, target);
+	runq_add(targetcpu, target);
 	if (isidle) {
 		/*
 		 * Other processor is idle; send interrupt to make
@@ -458,6 +1058,15 @@ thread_make_runnable(struct thread *target, bool already_have_lock)
 		 */
 		ipi_send(targetcpu, IPI_UNIDLE);
 	}
+	else if (!already_have_lock && targetcpu->c_runcount > 1) {
+		/*
+		 * Not when requeueing the current thread from
+		 * thread_switch: this cpu is about to run something
+		 * off its queue anyway, and an idle cpu woken now
+		 * could steal the very thread it was going to run.
+		 */
+		thread_kickidle(targetcpu);
+	}
 
 	if (!already_have_lock) {
 		spinlock_release(&targetcpu->c_runqueue_lock);
@@ -487,18 +1096,30 @@ thread_fork(const char *name,
 	DEBUG(DB_THREADS,"Forking thread: %s\n",name);
 #endif // UW
 
-	newthread = thread_create(name);
-	if (newthread == NULL) {
-		return ENOMEM;
+	newthread = thread_cache_get();
+	if (newthread != NULL) {
+		/* Recycled; it already has a stack with a guard band */
+		if (thread_init(newthread, name)) {
+			if (!thread_cache_put(newthread)) {
+				thread_destroy(newthread);
+			}
+			return ENOMEM;
+		}
 	}
+	else {
+		newthread = thread_create(name);
+		if (newthread == NULL) {
+			return ENOMEM;
+		}
 
-	/* Allocate a stack */
-	newthread->t_stack = kmalloc(STACK_SIZE);
-	if (newthread->t_stack == NULL) {
-		thread_destroy(newthread);
-		return ENOMEM;
+		/* Allocate a stack */
+		newthread->t_stack = kmalloc(STACK_SIZE);
+		if (newthread->t_stack == NULL) {
+			thread_destroy(newthread);
+			return ENOMEM;
+		}
+		thread_checkstack_init(newthread);
 	}
-	thread_checkstack_init(newthread);
 
 	/*
 	 * Now we clone various fields from the parent thread.
@@ -506,6 +1127,8 @@ thread_fork(const char *name,
 
 	/* Thread subsystem fields */
 	newthread->t_cpu = curthread->t_cpu;
+	newthread->t_nice = curthread->t_nice;
+	newthread->t_prio = thread_floor(newthread);
 
 	/* Attach the new thread to its process */
 	if (proc == NULL) {
@@ -548,6 +1171,8 @@ void
 thread_switch(threadstate_t newstate, struct wchan *wc)
 {
 	struct thread *cur, *next;
+	struct schedstat *ss;
+	uint64_t now, idlestart, ns;
 	int spl;
 
 	DEBUGASSERT(curcpu->c_curthread == curthread);
@@ -574,7 +1199,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 
 	/* Micro-optimization: if nothing to do, just return */
-	if (newstate == S_READY && threadlist_isempty(&curcpu->c_runqueue)) {
+	if (newstate == S_READY && !runq_haswork(curcpu, thread_level(cur))) {
 		spinlock_release(&curcpu->c_runqueue_lock);
 		splx(spl);
 		return;
@@ -585,10 +1210,15 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	    case S_RUN:
 		panic("Illegal S_RUN in thread_switch\n");
 	    case S_READY:
+		cur->t_usage.u_nivcsw++;
+		curcpu->c_stats.ss_nivcsw++;
 		thread_make_runnable(cur, true /*have lock*/);
 		break;
 	    case S_SLEEP:
+		cur->t_usage.u_nvcsw++;
+		curcpu->c_stats.ss_nvcsw++;
 		cur->t_wchan_name = wc->wc_name;
+		SCHEDTRACE(STE_SLEEP, cur, wc->wc_name, 0);
 		/*
 		 * Add the thread to the list in the wait channel, and
 		 * unlock same. To avoid a race with someone else
@@ -611,6 +1241,7 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 		break;
 	}
 	cur->t_state = newstate;
+	cur->t_lastrun = curcpu->c_hardclocks;
 
 	/*
 	 * Get the next thread. While there isn't one, call md_idle().
@@ -629,18 +1260,55 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	 * lock to look at it, this should not be visible or matter.
 	 */
 
+	ss = &curcpu->c_stats;
+	now = SCHEDSTAT_NOW();
+	ns = schedstat_since(curcpu->c_switchat, now);
+	cur->t_usage.u_runns += ns;
+	ss->ss_busyns += ns;
+
 	/* The current cpu is now idle. */
 	curcpu->c_isidle = true;
+	idlestart = 0;
 	do {
-		next = threadlist_remhead(&curcpu->c_runqueue);
+		next = runq_remhead(curcpu);
 		if (next == NULL) {
+			next = thread_steal();
+		}
+		if (next == NULL) {
+			if (idlestart == 0) {
+				idlestart = SCHEDSTAT_NOW();
+			}
 			spinlock_release(&curcpu->c_runqueue_lock);
+			/*
+			 * Tickless idle: hardclock has nothing to do
+			 * here, and new work arrives with an IPI.
+			 */
+			mainbus_stopclock();
 			cpu_idle();
+			mainbus_startclock();
 			spinlock_acquire(&curcpu->c_runqueue_lock);
 		}
 	} while (next == NULL);
 	curcpu->c_isidle = false;
 
+	/* Scheduler statistics; see schedstat_print. */
+	if (idlestart != 0) {
+		now = SCHEDSTAT_NOW();
+		ss->ss_idlens += schedstat_since(idlestart, now);
+	}
+	ns = schedstat_since(next->t_readyat, now);
+	next->t_usage.u_waitns += ns;
+	ss->ss_waitns += ns;
+	if (next->t_fromsleep) {
+		next->t_fromsleep = false;
+		ss->ss_nwakeups++;
+#if OPT_SCHEDSTAT
+		schedstat_latency(ss, ns);
+#endif
+	}
+	ss->ss_nswitch++;
+	curcpu->c_switchat = now;
+
 	/*
 	 * Note that curcpu->c_curthread may be the same variable as
 	 * curthread and it may not be, depending on how curthread and
@@ -648,6 +1316,9 @@ thread_switch(threadstate_t newstate, struct wchan *wc)
 	 * assume the compiler will optimize one away if they're the
 	 * same.
 	 */
+	SCHEDTRACE(STE_SWITCHOUT, cur, NULL, newstate);
+	SCHEDTRACE(STE_SWITCHIN, next, NULL, 0);
+
 	curcpu->c_curthread = next;
 	curthread = next;
 
@@ -822,17 +1493,143 @@ thread_yield(void)
 /*
  * Scheduler.
  *
- * This is called periodically from hardclock(). It should reshuffle
- * the current CPU's run queue by job priority.
+ * This is a multi-level feedback queue. Each cpu has SCHED_NPRIO run
+ * queues and always runs from the highest non-empty one, round-robin
+ * within a level. Threads start at the top. A thread that uses up its
+ * allotment of hardclocks at one level drops to the next (see
+ * thread_tick); one that wakes up from a sleep moves up a level (see
+ * thread_make_runnable). So cpu-bound threads sink and interactive
+ * ones stay near the top. To keep the sunken ones from starving,
+ * schedule() periodically puts everything back at the top. Niced
+ * threads are kept at or below a floor; see thread_floor. A thread
+ * holding a lock that others wait for runs at least at their level;
+ * see thread_level.
+ */
+
+/*
+ * The quantum: hardclocks a thread may run at level N before being
+ * preempted and demoted is sched_quantum << N. Lower levels get longer
+ * slices, since they hold the cpu-bound threads that benefit from
+ * running longer. Settable from the kernel menu.
+ */
+#define SCHED_QUANTUM	2
+static unsigned sched_quantum = SCHED_QUANTUM;
+
+unsigned
+thread_getquantum(void)
+{
+	return sched_quantum;
+}
+
+void
+thread_setquantum(unsigned ticks)
+{
+	KASSERT(ticks > 0);
+	sched_quantum = ticks;
+}
+
+/*
+ * Called from hardclock() on every tick. Only switches threads if the
+ * current one has used up its quantum, or if something of higher
+ * priority is waiting; otherwise the tick costs nothing.
  */
+void
+thread_tick(void)
+{
+	struct thread *cur = curthread;
+	unsigned slice;
 
+	if (curcpu->c_isidle) {
+		return;
+	}
+
+	slice = sched_quantum << cur->t_prio;
+	if (cur->t_nice < 0) {
+		slice += slice * -cur->t_nice / (-PRIO_MIN / 2);
+	}
+
+	cur->t_ticks++;
+	if (cur->t_ticks >= slice) {
+		/* Demote, and round-robin at the new level. */
+		if (cur->t_prio < SCHED_NPRIO - 1) {
+			cur->t_prio++;
+		}
+		cur->t_ticks = 0;
+		thread_yield();
+	}
+	else if (thread_level(cur) > 0 &&
+		 runq_haswork(curcpu, thread_level(cur) - 1)) {
+		/*
+		 * Preempted by a higher level; keep the rest of the
+		 * quantum for later. The check is without the run queue
+		 * lock, but thread_switch looks again.
+		 */
+		thread_yield();
+	}
+}
+
+/*
+ * Priority boost. This is called periodically from hardclock(); it
+ * moves every thread on the current cpu's run queue, and the current
+ * thread, back to the top level, or to its floor if it is niced.
+ */
 void
 schedule(void)
 {
+	struct threadlist moving;
+	struct thread *t;
+	unsigned i;
+
 	/*
-	 * You can write this. If we do nothing, threads will run in
-	 * round-robin fashion.
+	 * Take them all off first: a thread can go back on the queue
+	 * it came from (it is at its floor, or holds a lock), and
+	 * must not be seen again.
 	 */
+	threadlist_init(&moving);
+	spinlock_acquire(&curcpu->c_runqueue_lock);
+	for (i=1; i<SCHED_NPRIO; i++) {
+		while ((t = threadlist_remhead(&curcpu->c_runqueue[i])) != NULL) {
+			threadlist_addtail(&moving, t);
+		}
+	}
+	while ((t = threadlist_remhead(&moving)) != NULL) {
+		t->t_prio = thread_floor(t);
+		t->t_ticks = 0;
+		threadlist_addtail(&curcpu->c_runqueue[thread_level(t)], t);
+	}
+	if (!curcpu->c_isidle) {
+		curthread->t_prio = thread_floor(curthread);
+		curthread->t_ticks = 0;
+	}
+	spinlock_release(&curcpu->c_runqueue_lock);
+	threadlist_cleanup(&moving);
+}
+
+void
+thread_setinherit(struct thread *t, unsigned level)
+{
+	struct cpu *c;
+
+	KASSERT(level <= SCHED_NPRIO);
+
+	/* t_cpu can change under us until we hold its run queue lock */
+	while (1) {
+		c = t->t_cpu;
+		spinlock_acquire(&c->c_runqueue_lock);
+		if (t->t_cpu == c) {
+			break;
+		}
+		spinlock_release(&c->c_runqueue_lock);
+	}
+	if (runq_remove(c, t)) {
+		t->t_inherit = level;
+		runq_add(c, t);
+	}
+	else {
+		/* running, asleep, or in transit; it gets queued later */
+		t->t_inherit = level;
+	}
+	spinlock_release(&c->c_runqueue_lock);
 }
 
 /*
@@ -851,6 +1648,9 @@ schedule(void)
  * For here and now, because we know we're running on System/161 and
  * System/161 does not (yet) model such cache effects, we'll be very
  * aggressive.
+ *
+ * This only pushes work off busy cpus. A cpu that goes idle doesn't
+ * wait for it; it pulls work itself in thread_steal.
  */
 void
 thread_consider_migration(void)
@@ -865,12 +1665,11 @@ thread_consider_migration(void)
 	numcpus = cpuarray_num(&allcpus);
 	for (i=0; i<numcpus; i++) {
 		c = cpuarray_get(&allcpus, i);
-		spinlock_acquire(&c->c_runqueue_lock);
-		total_count += c->c_runqueue.tl_count;
+		/* An estimate is good enough; see thread_steal. */
+		total_count += c->c_runcount;
 		if (c == curcpu->c_self) {
-			my_count = c->c_runqueue.tl_count;
+			my_count = c->c_runcount;
 		}
-		spinlock_release(&c->c_runqueue_lock);
 	}
 
 	one_share = DIVROUNDUP(total_count, numcpus);
@@ -882,7 +1681,12 @@ thread_consider_migration(void)
 	threadlist_init(&victims);
 	spinlock_acquire(&curcpu->c_runqueue_lock);
 	for (i=0; i<to_send; i++) {
-		t = threadlist_remtail(&curcpu->c_runqueue);
+		t = runq_remtail(curcpu);
+		if (t == NULL) {
+			/* The count we went by was stale. */
+			to_send = i;
+			break;
+		}
 		threadlist_addhead(&victims, t);
 	}
 	spinlock_release(&curcpu->c_runqueue_lock);
@@ -893,7 +1697,7 @@ thread_consider_migration(void)
 			continue;
 		}
 		spinlock_acquire(&c->c_runqueue_lock);
-		while (c->c_runqueue.tl_count < one_share && to_send > 0) {
+		while (c->c_runcount < one_share && to_send > 0) {
 			t = threadlist_remhead(&victims);
 			/*
 			 * Ordinarily, curthread will not appear on
@@ -924,7 +1728,9 @@ thread_consider_migration(void)
 			}
 
 			t->t_cpu = c;
-			threadlist_addtail(&c->c_runqueue, t);
+			t->t_usage.u_nmigrations++;
+			SCHEDTRACE(STE_MIGRATE, t, NULL, c->c_number);
+			runq_add(c, t);
 			DEBUG(DB_THREADS,
 			      "Migrated thread %s: cpu %u -> %u",
 			      t->t_name, curcpu->c_number, c->c_number);
@@ -948,7 +1754,7 @@ thread_consider_migration(void)
 	if (!threadlist_isempty(&victims)) {
 		spinlock_acquire(&curcpu->c_runqueue_lock);
 		while ((t = threadlist_remhead(&victims)) != NULL) {
-			threadlist_addtail(&curcpu->c_runqueue, t);
+			runq_add(curcpu, t);
 		}
 		spinlock_release(&curcpu->c_runqueue_lock);
 	}
@@ -1090,6 +1896,48 @@ wchan_wakeall(struct wchan *wc)
 	threadlist_cleanup(&list);
 }
 
+/*
+ * Move one thread, or all threads, sleeping on FROM over to TO without
+ * waking them; they will be woken from TO instead. FROM must be locked
+ * by the caller, and stays locked.
+ */
+void
+wchan_moveone(struct wchan *from, struct wchan *to)
+{
+	struct thread *target;
+
+	KASSERT(spinlock_do_i_hold(&from->wc_lock));
+	KASSERT(from != to);
+
+	target = threadlist_remhead(&from->wc_threads);
+	if (target == NULL) {
+		return;
+	}
+	spinlock_acquire(&to->wc_lock);
+	target->t_wchan_name = to->wc_name;
+	threadlist_addtail(&to->wc_threads, target);
+	spinlock_release(&to->wc_lock);
+}
+
+void
+wchan_moveall(struct wchan *from, struct wchan *to)
+{
+	struct thread *target;
+
+	KASSERT(spinlock_do_i_hold(&from->wc_lock));
+	KASSERT(from != to);
+
+	if (threadlist_isempty(&from->wc_threads)) {
+		return;
+	}
+	spinlock_acquire(&to->wc_lock);
+	while ((target = threadlist_remhead(&from->wc_threads)) != NULL) {
+		target->t_wchan_name = to->wc_name;
+		threadlist_addtail(&to->wc_threads, target);
+	}
+	spinlock_release(&to->wc_lock);
+}
+
 /*
  * Return nonzero if there are no threads sleeping on the channel.
  * This is meant to be used only for diagnostic purposes.
@@ -43,6 +43,7 @@
 #include <fs.h>
 #include <vnode.h>
 #include <device.h>
+#include <execcache.h>
 
 /*
  * Structure for a single named device.
@@ -557,6 +558,9 @@ vfs_unmount(const char *devname)
 	struct knowndev *kd;
 	int result;
 
+	/* the exec image cache holds vnode references; let them go */
+	execcache_flush();
+
 	vfs_biglock_acquire();
 
 	result = findmount(devname, &kd);
@@ -603,6 +607,9 @@ vfs_unmountall(void)
 	unsigned i, num;
 	int result;
 
+	/* the exec image cache holds vnode references; let them go */
+	execcache_flush();
+
 	vfs_biglock_acquire();
 
 	num = knowndevarray_num(knowndevs);
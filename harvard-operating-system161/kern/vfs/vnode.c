@@ -36,6 +36,7 @@
 #include <synch.h>
 #include <vfs.h>
 #include <vnode.h>
+#include <execcache.h>
 
 /*
  * Initialize an abstract vnode.
@@ -53,6 +54,9 @@ vnode_init(struct vnode *vn, const struct vnode_ops *ops,
 	vn->vn_opencount = 0;
 	vn->vn_fs = fs;
 	vn->vn_data = fsdata;
+	spinlock_init(&vn->vn_eclock);
+	vn->vn_ecgen = 0;
+	vn->vn_ecached = false;
 	return 0;
 }
 
@@ -71,6 +75,8 @@ vnode_cleanup(struct vnode *vn)
 	vn->vn_opencount = 0;
 	vn->vn_fs = NULL;
 	vn->vn_data = NULL;
+	KASSERT(!vn->vn_ecached);
+	spinlock_cleanup(&vn->vn_eclock);
 }
 
 
@@ -166,6 +172,38 @@ vnode_decopen(struct vnode *vn)
 	vfs_biglock_release();
 }
 
+/*
+ * Write to a file, forgetting any cached copy of its contents both
+ * before, so nobody is handed the old contents while the write is in
+ * progress, and after, so nothing read during it stays cached.
+ * Invoked by VOP_WRITE.
+ */
+int
+vnode_write(struct vnode *vn, struct uio *uio)
+{
+	int result;
+
+	execcache_invalidate(vn);
+	result = __VOP(vn, write)(vn, uio);
+	execcache_invalidate(vn);
+	return result;
+}
+
+/*
+ * Truncate a file, forgetting any cached copy of its contents as for
+ * vnode_write. Invoked by VOP_TRUNCATE.
+ */
+int
+vnode_truncate(struct vnode *vn, off_t len)
+{
+	int result;
+
+	execcache_invalidate(vn);
+	result = __VOP(vn, truncate)(vn, len);
+	execcache_invalidate(vn);
+	return result;
+}
+
 /*
  * Check for various things being valid.
  * Called before all VOP_* calls.
@@ -0,0 +1,46 @@
+/*
+ * nice - run a command at a different scheduling priority.
+ * Usage: nice [-n increment] command [args...]
+ *
+ * Adds INCREMENT (default 10) to our nice value with setpriority and
+ * then execs the command, which keeps the new value, as do any
+ * processes it forks. A positive increment makes the command yield to
+ * everything that is not niced, e.g.
+ *
+ *	nice /testbin/triplesort
+ *
+ * leaves the shell responsive while the sorts run. The kernel clamps
+ * the result to PRIO_MIN..PRIO_MAX-1.
+ */
+
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <err.h>
+
+int
+main(int argc, char *argv[])
+{
+	int incr = 10, prio, first = 1;
+
+	if (argc > 2 && !strcmp(argv[1], "-n")) {
+		incr = atoi(argv[2]);
+		first = 3;
+	}
+	if (first >= argc) {
+		errx(1, "Usage: nice [-n increment] command [args...]");
+	}
+
+	errno = 0;
+	prio = getpriority(PRIO_PROCESS, 0);
+	if (prio == -1 && errno != 0) {
+		err(1, "getpriority");
+	}
+	if (setpriority(PRIO_PROCESS, 0, prio + incr) < 0) {
+		err(1, "setpriority");
+	}
+
+	execv(argv[first], argv + first);
+	err(1, "%s", argv[first]);
+}
@@ -0,0 +1,72 @@
+/*
+ * time - run a command and report what it cost.
+ * Usage: time command [args...]
+ *
+ * Runs the command as a child, waits for it, and prints the elapsed
+ * time together with the child's resource usage as reported by
+ * getrusage(RUSAGE_CHILDREN): user and system time, TLB faults,
+ * context switches and system calls. The exit status is the
+ * command's.
+ */
+
+#include <unistd.h>
+#include <stdio.h>
+#include <err.h>
+
+/* tv in hundredths of a second, for printing as %lu.%02lu */
+static
+unsigned long
+centisecs(const struct timeval *tv)
+{
+	return (unsigned long)tv->tv_sec * 100 + tv->tv_usec / 10000;
+}
+
+int
+main(int argc, char *argv[])
+{
+	time_t startsecs, endsecs;
+	unsigned long startnsecs, endnsecs, real, user, sys;
+	struct rusage ru;
+	pid_t pid;
+	int status;
+
+	if (argc < 2) {
+		errx(1, "Usage: time command [args...]");
+	}
+
+	__time(&startsecs, &startnsecs);
+	pid = spawn(argv[1], argv + 1);
+	if (pid < 0) {
+		err(1, "%s", argv[1]);
+	}
+	if (waitpid(pid, &status, 0) < 0) {
+		err(1, "waitpid");
+	}
+	__time(&endsecs, &endnsecs);
+
+	/* we have no other children, so this is all the command's */
+	if (getrusage(RUSAGE_CHILDREN, &ru) < 0) {
+		err(1, "getrusage");
+	}
+
+	real = (unsigned long)(endsecs - startsecs) * 100;
+	real = real + endnsecs / 10000000 - startnsecs / 10000000;
+	user = centisecs(&ru.ru_utime);
+	sys = centisecs(&ru.ru_stime);
+
+	printf("%8lu.%02lu real %8lu.%02lu user %8lu.%02lu sys\n",
+	       real / 100, real % 100, user / 100, user % 100,
+	       sys / 100, sys % 100);
+	printf("%8lu faults %8lu voluntary %8lu involuntary "
+	       "context switches %8lu syscalls\n",
+	       (unsigned long)ru.ru_minflt, (unsigned long)ru.ru_nvcsw,
+	       (unsigned long)ru.ru_nivcsw, (unsigned long)ru.ru_nsyscalls);
+	printf("%8lu cpu migrations %8lu.%02lu waiting to run\n",
+	       (unsigned long)ru.ru_nmigrations,
+	       centisecs(&ru.ru_wtime) / 100, centisecs(&ru.ru_wtime) % 100);
+
+	if (WIFEXITED(status)) {
+		return WEXITSTATUS(status);
+	}
+	return 1;
+}
@@ -42,6 +42,7 @@
 #include <kern/reboot.h>
 #include <kern/seek.h>
 #include <kern/time.h>
+#include <kern/resource.h>
 #include <kern/unistd.h>
 #include <kern/wait.h>
 
@@ -146,6 +147,17 @@ int link(const char *oldfile, const char *newfile);
 int chdir(const char *path);
 
 /* Optional. */
+pid_t vfork(void);
+pid_t spawn(const char *prog, char *const *args);	/* fork+execv in one */
+int thread_create(void (*func)(void *), void *arg);	/* returns thread id */
+__DEAD void thread_exit(int status);
+int thread_join(int tid, int *status);
+int futex_wait(volatile int *addr, int val);	/* if *addr == val */
+int futex_wake(volatile int *addr, int n);	/* returns # woken */
+int getrusage(int who, struct rusage *usage);
+int getpriority(int which, int who);		/* see kern/resource.h */
+int setpriority(int which, int who, int prio);
+int nanosleep(const struct timespec *req, struct timespec *rem);
 void *sbrk(int change);
 int getdirentry(int filehandle, char *buf, size_t buflen);
 int symlink(const char *target, const char *linkname);
@@ -154,6 +166,8 @@ int dup2(int filehandle, int newhandle);
 int pipe(int filehandles[2]);
 time_t __time(time_t *seconds, unsigned long *nanoseconds);
 int __getcwd(char *buf, size_t buflen);
+int __thread_create(void (*start)(void (*)(void *), void *),
+		    void (*func)(void *), void *arg);
 /* stat - see sys/stat.h */
 /* lstat - see sys/stat.h */
 
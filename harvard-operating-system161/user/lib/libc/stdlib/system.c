@@ -74,15 +74,10 @@ system(const char *cmd)
 
 	argv[nargs] = NULL;
 
-	pid = fork();
+	pid = spawn(argv[0], argv);
 	switch (pid) {
 	    case -1:
 		return -1;
-	    case 0:
-		/* child */
-		execv(argv[0], argv);
-		/* exec only returns if it fails */
-		_exit(255);
 	    default:
 		/* parent */
 		waitpid(pid, &status, 0);
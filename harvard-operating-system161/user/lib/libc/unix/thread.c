@@ -0,0 +1,24 @@
+/*
+ * User-level threads: thread_create on top of the __thread_create
+ * system call. thread_exit and thread_join are plain system calls.
+ */
+
+#include <unistd.h>
+
+/*
+ * Where every new thread starts. The kernel cannot return anywhere
+ * useful when FUNC does, so we do the thread_exit here.
+ */
+static
+void
+thread_start(void (*func)(void *), void *arg)
+{
+	func(arg);
+	thread_exit(0);
+}
+
+int
+thread_create(void (*func)(void *), void *arg)
+{
+	return __thread_create(thread_start, func, arg);
+}
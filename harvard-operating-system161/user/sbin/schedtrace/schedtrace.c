@@ -0,0 +1,220 @@
+/*
+ * schedtrace - print a scheduler trace dump as a timeline.
+ *
+ * The dump comes from the kernel menu ("st start", "st stop",
+ * "st dump file"); see kern/thread/schedtrace.c. Each cpu's events are
+ * already in order, so they are merged by timestamp. Times are shown
+ * in microseconds from the first event. When a thread starts running,
+ * the time since it last became runnable is shown too: that is how
+ * long it sat on a run queue.
+ *
+ * Runs on OS/161 or on the host.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <err.h>
+
+#include "kern/schedtrace.h"
+
+#ifdef HOST
+
+#include <netinet/in.h> // for arpa/inet.h
+#include <arpa/inet.h>  // for ntohl
+#include "hostcompat.h"
+#define SWAPL(x) ntohl(x)
+
+#else
+
+#define SWAPL(x) (x)
+
+#endif
+
+/* Threads we remember the last time-became-runnable of */
+#define MAXTHREADS 1024
+
+struct cpulog {
+	unsigned cl_cpu;
+	unsigned cl_n;
+	unsigned cl_pos;
+	struct schedtrace_record *cl_recs;
+};
+
+static struct {
+	uint32_t id;
+	uint64_t readyat;	/* usec; 0 if not waiting */
+} threads[MAXTHREADS];
+
+static int fd;
+
+static
+void
+doread(void *buf, size_t len)
+{
+	ssize_t r;
+
+	r = read(fd, buf, len);
+	if (r < 0) {
+		err(1, "read");
+	}
+	if ((size_t)r < len) {
+		errx(1, "Short read: truncated dump?");
+	}
+}
+
+static
+uint64_t
+usecs(const struct schedtrace_record *sr)
+{
+	return (uint64_t)SWAPL(sr->sr_sec) * 1000000 +
+		SWAPL(sr->sr_nsec) / 1000;
+}
+
+/* The slot for thread ID; recycles slots when the table is full. */
+static
+unsigned
+threadslot(uint32_t id)
+{
+	unsigned i, h;
+
+	h = (id >> 3) % MAXTHREADS;
+	for (i=0; i<MAXTHREADS; i++) {
+		if (threads[h].id == id || threads[h].id == 0) {
+			break;
+		}
+		h = (h + 1) % MAXTHREADS;
+	}
+	threads[h].id = id;
+	return h;
+}
+
+static
+void
+printevent(const struct schedtrace_record *sr, unsigned cpu, uint64_t start)
+{
+	uint64_t t;
+	unsigned slot;
+	uint32_t arg;
+
+	t = usecs(sr);
+	arg = SWAPL(sr->sr_arg);
+	slot = threadslot(SWAPL(sr->sr_thread));
+
+	printf("%10llu  cpu%-2u  ", (unsigned long long)(t - start), cpu);
+	switch (SWAPL(sr->sr_type)) {
+	    case STE_SWITCHOUT:
+		printf("out     %-16s %s\n", sr->sr_thname,
+		       arg == STS_READY ? "preempted" :
+		       arg == STS_SLEEP ? "asleep" :
+		       arg == STS_ZOMBIE ? "exited" : "?");
+		if (arg == STS_READY) {
+			threads[slot].readyat = t;
+		}
+		break;
+	    case STE_SWITCHIN:
+		printf("in      %-16s", sr->sr_thname);
+		if (threads[slot].readyat != 0) {
+			printf(" waited %llu us", (unsigned long long)
+			       (t - threads[slot].readyat));
+			threads[slot].readyat = 0;
+		}
+		printf("\n");
+		break;
+	    case STE_WAKEUP:
+		printf("wakeup  %-16s -> cpu%u\n", sr->sr_thname, arg);
+		threads[slot].readyat = t;
+		break;
+	    case STE_SLEEP:
+		printf("sleep   %-16s on %s\n", sr->sr_thname, sr->sr_wcname);
+		break;
+	    case STE_MIGRATE:
+		printf("migrate %-16s -> cpu%u\n", sr->sr_thname, arg);
+		break;
+	    default:
+		printf("unknown event %u\n", SWAPL(sr->sr_type));
+		break;
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	struct schedtrace_header sh;
+	struct schedtrace_cpu sc;
+	struct cpulog *logs, *best;
+	unsigned ncpus, i;
+	uint64_t start, t, bestt;
+
+#ifdef HOST
+	hostcompat_init(argc, argv);
+#endif
+
+	if (argc != 2) {
+		errx(1, "Usage: schedtrace dumpfile");
+	}
+	fd = open(argv[1], O_RDONLY);
+	if (fd < 0) {
+		err(1, "%s", argv[1]);
+	}
+
+	doread(&sh, sizeof(sh));
+	if (SWAPL(sh.sh_magic) != SCHEDTRACE_MAGIC) {
+		errx(1, "%s: Not a scheduler trace", argv[1]);
+	}
+	ncpus = SWAPL(sh.sh_ncpus);
+	logs = malloc(ncpus * sizeof(*logs));
+	if (logs == NULL) {
+		err(1, "malloc");
+	}
+
+	for (i=0; i<ncpus; i++) {
+		doread(&sc, sizeof(sc));
+		logs[i].cl_cpu = SWAPL(sc.sc_cpu);
+		logs[i].cl_n = SWAPL(sc.sc_nrecords);
+		logs[i].cl_pos = 0;
+		logs[i].cl_recs = malloc(logs[i].cl_n *
+					 sizeof(struct schedtrace_record));
+		if (logs[i].cl_n > 0 && logs[i].cl_recs == NULL) {
+			err(1, "malloc");
+		}
+		doread(logs[i].cl_recs,
+		       logs[i].cl_n * sizeof(struct schedtrace_record));
+		if (SWAPL(sc.sc_lost) > 0) {
+			printf("cpu%u: oldest %u events were overwritten\n",
+			       logs[i].cl_cpu, SWAPL(sc.sc_lost));
+		}
+	}
+	close(fd);
+
+	/* Merge: repeatedly take the earliest next event of any cpu. */
+	start = 0;
+	while (1) {
+		best = NULL;
+		bestt = 0;
+		for (i=0; i<ncpus; i++) {
+			if (logs[i].cl_pos == logs[i].cl_n) {
+				continue;
+			}
+			t = usecs(&logs[i].cl_recs[logs[i].cl_pos]);
+			if (best == NULL || t < bestt) {
+				best = &logs[i];
+				bestt = t;
+			}
+		}
+		if (best == NULL) {
+			break;
+		}
+		if (start == 0) {
+			start = bestt;
+		}
+		printevent(&best->cl_recs[best->cl_pos], best->cl_cpu, start);
+		best->cl_pos++;
+	}
+
+	return 0;
+}
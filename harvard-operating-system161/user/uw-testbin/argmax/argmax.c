@@ -0,0 +1,62 @@
+/*
+ * argmax - argument vectors near and past ARG_MAX.
+ *
+ *  1. spawn /bin/true with NARGS arguments; it must start and exit 0.
+ *  2. execv with more than ARG_MAX bytes of arguments must fail with
+ *     E2BIG and leave this process running.
+ *
+ *  Example of correct output:  argmax: passed
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <err.h>
+
+#define NARGS 1000
+#define BIGLEN 1000
+
+static char *args[NARGS+2];
+static char big[BIGLEN];
+
+int
+main(int argc, char *argv[])
+{
+  (void)argc;
+  (void)argv;
+  int i, rval;
+  pid_t pid;
+
+  /* 1 */
+  args[0] = (char *)"/bin/true";
+  for (i=1; i<=NARGS; i++) {
+    args[i] = (char *)"arg";
+  }
+  args[NARGS+1] = NULL;
+  pid = spawn(args[0], args);
+  if (pid < 0) {
+    err(1,"spawn with %d args", NARGS);
+  }
+  if (waitpid(pid, &rval, 0) != pid) {
+    err(1,"waitpid");
+  }
+  if (!WIFEXITED(rval) || WEXITSTATUS(rval) != 0) {
+    errx(1,"/bin/true with %d args: status %d", NARGS, rval);
+  }
+
+  /* 2: every argument is BIGLEN bytes, well over ARG_MAX in total */
+  memset(big, 'x', BIGLEN-1);
+  big[BIGLEN-1] = 0;
+  for (i=1; i<=NARGS; i++) {
+    args[i] = big;
+  }
+  execv(args[0], args);
+  if (errno != E2BIG) {
+    err(1,"execv with %d bytes of args", NARGS*BIGLEN);
+  }
+
+  printf("argmax: passed\n");
+  return(0);
+}
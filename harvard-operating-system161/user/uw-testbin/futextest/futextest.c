@@ -0,0 +1,86 @@
+/*
+ * futextest - futex_wait and futex_wake between two threads.
+ *
+ *  1. futex_wait on a word that no longer holds the expected value
+ *     must fail with EAGAIN instead of sleeping.
+ *  2. the main thread and a second thread hand a turn word back and
+ *     forth NROUNDS times, each sleeping in futex_wait until the other
+ *     has flipped it. Neither ever spins, so a lost wakeup hangs.
+ *
+ *  Example of correct output:  futextest: passed
+ */
+#include <unistd.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define NROUNDS 1000
+
+static volatile int turn = 0;		/* whose go it is: 0 main, 1 pong */
+
+/* wait until it is WHO's go */
+static
+void
+waitturn(int who)
+{
+  int t;
+
+  while ((t = turn) != who) {
+    if (futex_wait(&turn, t) < 0 && errno != EAGAIN) {
+      err(1, "futex_wait");
+    }
+  }
+}
+
+/* give the go to WHO */
+static
+void
+giveturn(int who)
+{
+  turn = who;
+  if (futex_wake(&turn, 1) < 0) {
+    err(1, "futex_wake");
+  }
+}
+
+static
+void
+pong(void *unused)
+{
+  int i;
+
+  (void)unused;
+  for (i=0; i<NROUNDS; i++) {
+    waitturn(1);
+    giveturn(0);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  (void)argc;
+  (void)argv;
+  int i, tid;
+
+  /* 1 */
+  if (futex_wait(&turn, 1) == 0 || errno != EAGAIN) {
+    errx(1, "futex_wait on a stale value did not fail with EAGAIN");
+  }
+
+  /* 2 */
+  tid = thread_create(pong, NULL);
+  if (tid < 0) {
+    err(1, "thread_create");
+  }
+  for (i=0; i<NROUNDS; i++) {
+    giveturn(1);
+    waitturn(0);
+  }
+  if (thread_join(tid, NULL) < 0) {
+    err(1, "thread_join");
+  }
+
+  printf("futextest: passed\n");
+  return 0;
+}
@@ -0,0 +1,134 @@
+/*
+ * sleeptest - nanosleep.
+ *
+ *  1. a malformed request fails with EINVAL.
+ *  2. NSLEEPERS processes sleep for different lengths of time at once;
+ *     each checks with __time that it slept at least as long as asked.
+ *  3. a thread asleep for a minute does not hold up its process's
+ *     exit: the child's main thread exits right away and the parent
+ *     must be able to collect it well before the minute is up.
+ *
+ *  Example of correct output:  sleeptest: passed
+ */
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <err.h>
+
+#define NSLEEPERS 32
+#define LONGSLEEP 60		/* seconds */
+
+/* milliseconds since START */
+static
+unsigned long
+elapsed(time_t ssecs, unsigned long snsecs)
+{
+  time_t secs;
+  unsigned long nsecs;
+
+  __time(&secs, &nsecs);
+  return (unsigned long)(secs - ssecs) * 1000 + nsecs / 1000000
+    - snsecs / 1000000;
+}
+
+/* sleep for MS milliseconds, and check that it was long enough */
+static
+void
+sleeper(unsigned ms)
+{
+  struct timespec ts;
+  time_t ssecs;
+  unsigned long snsecs, took;
+
+  ts.tv_sec = ms / 1000;
+  ts.tv_nsec = (ms % 1000) * 1000000;
+  __time(&ssecs, &snsecs);
+  if (nanosleep(&ts, NULL) < 0) {
+    err(1, "nanosleep");
+  }
+  took = elapsed(ssecs, snsecs);
+  /* __time is only good to the millisecond we round down to */
+  if (took + 1 < ms) {
+    errx(1, "asked for %u ms, slept %lu", ms, took);
+  }
+  exit(0);
+}
+
+static
+void
+longsleep(void *unused)
+{
+  struct timespec ts;
+
+  (void)unused;
+  ts.tv_sec = LONGSLEEP;
+  ts.tv_nsec = 0;
+  nanosleep(&ts, NULL);
+}
+
+int
+main(int argc, char *argv[])
+{
+  (void)argc;
+  (void)argv;
+  struct timespec ts;
+  pid_t pids[NSLEEPERS], pid;
+  int i, status;
+  time_t ssecs;
+  unsigned long snsecs;
+
+  /* 1 */
+  ts.tv_sec = 0;
+  ts.tv_nsec = 1000000000;
+  if (nanosleep(&ts, NULL) == 0 || errno != EINVAL) {
+    errx(1, "nanosleep with tv_nsec of a second did not fail with EINVAL");
+  }
+
+  /* 2 */
+  for (i=0; i<NSLEEPERS; i++) {
+    pids[i] = fork();
+    if (pids[i] < 0) {
+      err(1, "fork");
+    }
+    if (pids[i] == 0) {
+      sleeper(25 * (i % 8 + 1) + i);
+    }
+  }
+  for (i=0; i<NSLEEPERS; i++) {
+    if (waitpid(pids[i], &status, 0) < 0) {
+      err(1, "waitpid");
+    }
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      errx(1, "sleeper %d failed", i);
+    }
+  }
+
+  /* 3 */
+  __time(&ssecs, &snsecs);
+  pid = fork();
+  if (pid < 0) {
+    err(1, "fork");
+  }
+  if (pid == 0) {
+    if (thread_create(longsleep, NULL) < 0) {
+      err(1, "thread_create");
+    }
+    /* give it time to get to sleep */
+    ts.tv_sec = 0;
+    ts.tv_nsec = 100000000;
+    nanosleep(&ts, NULL);
+    exit(0);
+  }
+  if (waitpid(pid, &status, 0) < 0) {
+    err(1, "waitpid");
+  }
+  if (elapsed(ssecs, snsecs) >= LONGSLEEP * 1000 / 2) {
+    errx(1, "exit waited for a sleeping thread");
+  }
+
+  printf("sleeptest: passed\n");
+  return 0;
+}
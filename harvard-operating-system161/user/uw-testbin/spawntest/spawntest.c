@@ -0,0 +1,86 @@
+/*
+ * spawntest - start children with vfork and spawn instead of fork.
+ *
+ *  1. a vfork child runs in the parent's address space, so a store it
+ *     makes before _exit must be visible to the parent afterwards.
+ *  2. a vfork child that execs /bin/false must report exit status 1.
+ *  3. spawn of /bin/true must report exit status 0.
+ *  4. spawn of a program that does not exist must fail in the parent.
+ *
+ *  Example of correct output:  spawntest: passed
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+static volatile int shared;
+
+static
+void
+check(pid_t pid, int expect, const char *what)
+{
+  int rval;
+
+  if (waitpid(pid, &rval, 0) != pid) {
+    err(1,"waitpid %s", what);
+  }
+  if (!WIFEXITED(rval) || WEXITSTATUS(rval) != expect) {
+    errx(1,"%s: status %d, expected exit %d", what, rval, expect);
+  }
+}
+
+int
+main(int argc, char *argv[])
+{
+  (void)argc;
+  (void)argv;
+  char *args[2];
+  pid_t pid;
+
+  /* 1 */
+  shared = 0;
+  pid = vfork();
+  if (pid < 0) {
+    err(1,"vfork");
+  }
+  if (pid == 0) {
+    shared = 42;
+    _exit(3);
+  }
+  check(pid, 3, "vfork/_exit");
+  if (shared != 42) {
+    errx(1,"vfork child did not share the address space");
+  }
+
+  /* 2 */
+  args[0] = (char *)"/bin/false";
+  args[1] = NULL;
+  pid = vfork();
+  if (pid < 0) {
+    err(1,"vfork");
+  }
+  if (pid == 0) {
+    execv(args[0], args);
+    _exit(99);
+  }
+  check(pid, 1, "vfork/execv");
+
+  /* 3 */
+  args[0] = (char *)"/bin/true";
+  pid = spawn(args[0], args);
+  if (pid < 0) {
+    err(1,"spawn %s", args[0]);
+  }
+  check(pid, 0, "spawn");
+
+  /* 4 */
+  args[0] = (char *)"/bin/no-such-program";
+  if (spawn(args[0], args) >= 0) {
+    errx(1,"spawn of %s succeeded", args[0]);
+  }
+
+  printf("spawntest: passed\n");
+  return(0);
+}
@@ -0,0 +1,75 @@
+/*
+ * waitany - parent forks several children and reaps them with
+ *  waitpid(-1, ...) and WNOHANG instead of by pid.
+ *
+ *  children exit with their child number (1..NKIDS).
+ *  the parent first polls with WNOHANG until something has exited,
+ *  then collects the rest with blocking waitpid(-1). every child must
+ *  be reported exactly once, and a final waitpid(-1) must fail with
+ *  ECHILD.
+ *
+ *  Example of correct output:  waitany: passed
+ */
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <err.h>
+
+#define NKIDS 8
+
+int
+main(int argc, char *argv[])
+{
+  (void)argc;
+  (void)argv;
+  pid_t pids[NKIDS+1];
+  int seen[NKIDS+1];
+  int i, rval, polls;
+  pid_t pid;
+
+  for (i=1; i<=NKIDS; i++) {
+    seen[i] = 0;
+    pids[i] = fork();
+    if (pids[i] < 0) {
+      errx(1,"fork %d",i);
+    }
+    if (pids[i] == 0) {
+      _exit(i);
+    }
+  }
+
+  /* poll until at least one child is done */
+  polls = 0;
+  do {
+    pid = waitpid(-1, &rval, WNOHANG);
+    if (pid < 0) {
+      err(1,"waitpid WNOHANG");
+    }
+    polls++;
+  } while (pid == 0);
+
+  for (i=0; i<NKIDS; i++) {
+    if (i > 0) {
+      pid = waitpid(-1, &rval, 0);
+      if (pid < 0) {
+        err(1,"waitpid");
+      }
+    }
+    if (!WIFEXITED(rval) || WEXITSTATUS(rval) < 1 ||
+        WEXITSTATUS(rval) > NKIDS) {
+      errx(1,"bad status %d for pid %d", rval, pid);
+    }
+    if (pids[WEXITSTATUS(rval)] != pid || seen[WEXITSTATUS(rval)]) {
+      errx(1,"pid %d reported wrongly", pid);
+    }
+    seen[WEXITSTATUS(rval)] = 1;
+  }
+
+  if (waitpid(-1, &rval, 0) >= 0 || errno != ECHILD) {
+    errx(1,"waitpid with no children did not fail with ECHILD");
+  }
+
+  printf("waitany: passed (%d polls)\n", polls);
+  return(0);
+}